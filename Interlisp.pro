@@ -18,6 +18,17 @@ SOURCES += \
     LispHighlighter.cpp \
     LispBuiltins.cpp \
     LispRowCol.cpp \
+    LispTokenRing.cpp \
+    LispTrace.cpp \
+    LispProject.cpp \
+    LispDiff.cpp \
+    LispCallGraph.cpp \
+    LispQuery.cpp \
+    LispHeap.cpp \
+    LispEvaluator.cpp \
+    LispCompiler.cpp \
+    LispMachine.cpp \
+    LispBench.cpp \
     LispNavigator.cpp \
     ../GuiTools/AutoShortcut.cpp
 
@@ -31,6 +42,17 @@ HEADERS  += \
     LispHighlighter.h \
     LispBuiltins.h \
     LispRowCol.h \
+    LispTokenRing.h \
+    LispTrace.h \
+    LispProject.h \
+    LispDiff.h \
+    LispCallGraph.h \
+    LispQuery.h \
+    LispHeap.h \
+    LispEvaluator.h \
+    LispCompiler.h \
+    LispMachine.h \
+    LispBench.h \
     LispNavigator.h \
     ../GuiTools/AutoShortcut.h
 
@@ -42,5 +64,11 @@ CONFIG(debug, debug|release) {
     QMAKE_CXXFLAGS += -Wno-reorder -Wno-unused-parameter -Wno-unused-function -Wno-unused-variable
 }
 
+asan {
+    # qmake CONFIG+=asan, then InterlispNavigator -bench checks the heap for use after free
+    QMAKE_CXXFLAGS += -fsanitize=address -fno-omit-frame-pointer
+    QMAKE_LFLAGS += -fsanitize=address
+}
+
 RESOURCES += \
     Navigator.qrc
@@ -0,0 +1,159 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include "LispBench.h"
+#include "LispEvaluator.h"
+#include "LispMachine.h"
+#include "LispTrace.h"
+#include <QBuffer>
+#include <QElapsedTimer>
+using namespace Lisp;
+
+static const char* s_source =
+        "(DEFINEQ\n"
+        "(TAK (LAMBDA (X Y Z)\n"
+        "  (COND ((NOT (ILESSP Y X)) Z)\n"
+        "        (T (TAK (TAK (SUB1 X) Y Z) (TAK (SUB1 Y) Z X) (TAK (SUB1 Z) X Y))))))\n"
+        "(FIB (LAMBDA (N)\n"
+        "  (COND ((ILESSP N 2) N)\n"
+        "        (T (IPLUS (FIB (SUB1 N)) (FIB (IDIFFERENCE N 2)))))))\n"
+        "(IOTA (LAMBDA (N)\n"
+        "  (PROG (L)\n"
+        "   LP (COND ((ZEROP N) (RETURN L)))\n"
+        "      (SETQ L (CONS N L))\n"
+        "      (SETQ N (SUB1 N))\n"
+        "      (GO LP))))\n"
+        "(REV (LAMBDA (L)\n"
+        "  (PROG (R)\n"
+        "   LP (COND ((NULL L) (RETURN R)))\n"
+        "      (SETQ R (CONS (CAR L) R))\n"
+        "      (SETQ L (CDR L))\n"
+        "      (GO LP))))\n"
+        "(REVLOOP (LAMBDA (N L)\n"
+        "  (PROG NIL\n"
+        "   LP (COND ((ZEROP N) (RETURN L)))\n"
+        "      (SETQ L (REV L))\n"
+        "      (SETQ N (SUB1 N))\n"
+        "      (GO LP))))\n"
+        "(GARBAGE (LAMBDA (N)\n"
+        "  (PROG (X Y)\n"
+        "   LP (COND ((ZEROP N) (RETURN (LENGTH X))))\n"
+        "      (SETQ Y (LIST (LIST N) (LIST (LIST N))))\n"
+        "      (RPLACA Y Y)\n"
+        "      (SETQ X (CONS Y (CDR X)))\n"
+        "      (SETQ N (SUB1 N))\n"
+        "      (GO LP))))\n"
+        ")\n"
+        "STOP\n";
+
+struct BenchCase
+{
+    const char* form;
+    const char* expected; // printed result
+};
+
+static const BenchCase s_cases[] = {
+    { "(TAK 18 12 6)", "7" },
+    { "(FIB 20)", "6765" },
+    { "(CAR (REVLOOP 100 (IOTA 200)))", "1" },
+    { "(GARBAGE 100000)", "1" }, // nested and cyclic dead lists; run with CONFIG+=asan
+    { 0, 0 }
+};
+
+static Reader::Object read(const QByteArray& code, QString& error)
+{
+    QBuffer in;
+    in.setData(code);
+    in.open(QIODevice::ReadOnly);
+    Reader r;
+    if( !r.read(&in, "bench") )
+    {
+        error = r.getError();
+        return Reader::Object();
+    }
+    return r.getAst(); // a list of the top-level forms
+}
+
+QStringList Bench::run(int repeat)
+{
+    Trace::Span span("bench");
+    QStringList res;
+    QString error;
+    const Reader::Object code = read(s_source, error);
+    if( !error.isEmpty() )
+        return res << QString("cannot read the benchmarks: %1").arg(error);
+    Evaluator e;
+    Machine m(&e);
+    m.load(code);
+    foreach( const QString& msg, m.getCompileErrors() )
+        res << QString("not compiled: %1").arg(msg);
+    Reader::Object value; // refers to cells across collections, so it has to be a root
+    e.getHeap()->addRoot(&value);
+
+    for( int i = 0; s_cases[i].form; i++ )
+    {
+        const Reader::Object top = read(QByteArray(s_cases[i].form) + "\nSTOP\n", error);
+        if( top.type() != Reader::Object::List_ || top.getList()->list.isEmpty() )
+        {
+            res << QString("%1: cannot read: %2").arg(s_cases[i].form).arg(error);
+            continue;
+        }
+        const Reader::Object form = top.getList()->list.first();
+        QString line = s_cases[i].form;
+        qint64 best[2] = { -1, -1 };
+        Code* c = m.compile(form); // once per case, so the timer only sees the execution
+        for( int compiled = 0; compiled < 2; compiled++ )
+        {
+            for( int j = 0; j < qMax(repeat, 1); j++ )
+            {
+                QElapsedTimer t;
+                t.start();
+                if( !compiled )
+                    value = e.run(form);
+                else
+                    value = c ? m.run(c) : m.run(form);
+                const qint64 ns = t.nsecsElapsed();
+                if( best[compiled] < 0 || ns < best[compiled] )
+                    best[compiled] = ns;
+            }
+            const QString msg = compiled ? m.getError() : e.getError();
+            const QByteArray printed = value.toString();
+            if( !msg.isEmpty() )
+                line += QString(", %1 error: %2").arg(compiled ? "compiled" : "interpreted").arg(msg);
+            else
+                line += QString(", %1 = %2%3 in %4 [ms]").arg(compiled ? "compiled" : "interpreted")
+                        .arg(printed.constData())
+                        .arg(printed == s_cases[i].expected ? "" : QString(" (expected %1)").arg(s_cases[i].expected))
+                        .arg(best[compiled] / 1000000.0, 0, 'f', 2);
+        }
+        delete c;
+        if( best[1] > 0 )
+            line += QString(", speedup %1").arg(double(best[0]) / best[1], 0, 'f', 1);
+        res << line;
+    }
+    value = Reader::Object();
+    e.getHeap()->removeRoot(&value);
+    const Heap* h = e.getHeap();
+    res << QString("heap: %1 minor and %2 full collections, %3 cells freed, %4 young and %5 tenured left")
+           .arg(h->getMinorCount()).arg(h->getFullCount()).arg(h->getFreed()).arg(h->getYoung())
+           .arg(h->getTenured());
+    return res;
+}
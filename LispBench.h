@@ -0,0 +1,40 @@
+#ifndef LISPBENCH_H
+#define LISPBENCH_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include <QStringList>
+
+namespace Lisp
+{
+
+// Runs the classic Gabriel style benchmarks (TAK, FIB and list reversal) on the Evaluator and on
+// the bytecode Machine and reports the results and times; the Interlisp source is embedded.
+class Bench
+{
+public:
+    static QStringList run(int repeat = 3); // the best time of repeat runs is reported
+};
+
+}
+
+#endif // LISPBENCH_H
@@ -0,0 +1,117 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include "LispCallGraph.h"
+#include "LispTrace.h"
+#include <algorithm>
+using namespace Lisp;
+
+void CallGraph::clear()
+{
+    outStart.clear();
+    outEdges.clear();
+    inStart.clear();
+    inEdges.clear();
+}
+
+void CallGraph::toRows(QVector<quint64>& edges, quint32 nodes, QVector<quint32>& start, QVector<quint32>& targets)
+{
+    // edges are from << 32 | to; sorting groups them by from and makes duplicates adjacent
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+    start.fill(0, nodes + 1);
+    targets.resize(edges.size());
+    for( int i = 0; i < edges.size(); i++ )
+    {
+        start[quint32(edges[i] >> 32) + 1]++;
+        targets[i] = quint32(edges[i]);
+    }
+    for( quint32 i = 0; i < nodes; i++ )
+        start[i + 1] += start[i];
+}
+
+void CallGraph::build(const Reader::Calls& calls, quint32 atomCount)
+{
+    Trace::Span span("call graph");
+    QVector<quint64> edges = calls;
+    toRows(edges, atomCount, outStart, outEdges);
+    for( int i = 0; i < edges.size(); i++ )
+        edges[i] = ( edges[i] << 32 ) | ( edges[i] >> 32 );
+    toRows(edges, atomCount, inStart, inEdges);
+}
+
+QVector<quint32> CallGraph::callees(quint32 atom) const
+{
+    if( atom >= nodeCount() )
+        return QVector<quint32>();
+    return outEdges.mid(outStart[atom], outStart[atom + 1] - outStart[atom]);
+}
+
+QVector<quint32> CallGraph::callers(quint32 atom) const
+{
+    if( atom >= nodeCount() )
+        return QVector<quint32>();
+    return inEdges.mid(inStart[atom], inStart[atom + 1] - inStart[atom]);
+}
+
+QBitArray CallGraph::reach(quint32 atom, bool reverse) const
+{
+    QBitArray res(nodeCount());
+    if( atom >= nodeCount() )
+        return res;
+    const QVector<quint32>& start = reverse ? inStart : outStart;
+    const QVector<quint32>& targets = reverse ? inEdges : outEdges;
+    QVector<quint32> queue;
+    queue.append(atom);
+    for( int i = 0; i < queue.size(); i++ )
+    {
+        const quint32 cur = queue[i];
+        for( quint32 e = start[cur]; e < start[cur + 1]; e++ )
+        {
+            const quint32 next = targets[e];
+            if( !res.testBit(next) )
+            {
+                res.setBit(next);
+                queue.append(next);
+            }
+        }
+    }
+    return res;
+}
+
+qint64 CallGraph::byteSize() const
+{
+    return ( outStart.capacity() + outEdges.capacity() + inStart.capacity() + inEdges.capacity() ) *
+            sizeof(quint32);
+}
+
+QVector<quint32> CallGraph::toIds(const QBitArray& bits)
+{
+    QVector<quint32> res;
+    const int count = bits.count(true);
+    res.reserve(count);
+    for( int i = 0; i < bits.size() && res.size() < count; i++ )
+    {
+        if( bits.testBit(i) )
+            res.append(i);
+    }
+    return res;
+}
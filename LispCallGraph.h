@@ -0,0 +1,59 @@
+#ifndef LISPCALLGRAPH_H
+#define LISPCALLGRAPH_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include <QBitArray>
+#include "LispReader.h"
+
+namespace Lisp
+{
+
+// The calls of the DEFINEQ functions as adjacency arrays over atom ids (compressed sparse rows),
+// together with the reverse graph; transitive queries are breadth-first searches which mark the
+// visited atoms in a bit array.
+class CallGraph
+{
+public:
+    CallGraph() {}
+
+    void clear();
+    void build(const Reader::Calls& calls, quint32 atomCount);
+    quint32 nodeCount() const { return outStart.isEmpty() ? 0 : outStart.size() - 1; }
+    int edgeCount() const { return outEdges.size(); }
+    QVector<quint32> callees(quint32 atom) const;
+    QVector<quint32> callers(quint32 atom) const;
+    // all atoms atom eventually calls, or with reverse all which eventually call atom;
+    // atom itself is only included if it is recursive
+    QBitArray reach(quint32 atom, bool reverse = false) const;
+    qint64 byteSize() const;
+
+    static QVector<quint32> toIds(const QBitArray&);
+private:
+    static void toRows(QVector<quint64>& edges, quint32 nodes, QVector<quint32>& start, QVector<quint32>& targets);
+    QVector<quint32> outStart, outEdges; // callees of atom i are outEdges[outStart[i]..outStart[i+1])
+    QVector<quint32> inStart, inEdges;
+};
+
+}
+
+#endif // LISPCALLGRAPH_H
@@ -0,0 +1,770 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include "LispCompiler.h"
+#include "LispLexer.h"
+#include "LispProject.h"
+using namespace Lisp;
+
+#define LISP_OP_NAME(name, len, effect) #name,
+static const char* s_names[] = { LISP_OPCODES(LISP_OP_NAME) 0 };
+#define LISP_OP_LEN(name, len, effect) len,
+static const int s_operands[] = { LISP_OPCODES(LISP_OP_LEN) 0 };
+#define LISP_OP_EFFECT(name, len, effect) effect,
+static const int s_effects[] = { LISP_OPCODES(LISP_OP_EFFECT) 0 };
+
+static quint32 idOf(const char* name)
+{
+    return Token::getSymbolId(Token::getSymbol(name).constData());
+}
+
+static inline quint16 u16(const char* p)
+{
+    return quint16(quint8(p[0]) << 8 | quint8(p[1]));
+}
+
+const char* Code::name(quint8 op)
+{
+    return op < MaxOp ? s_names[op] : "?";
+}
+
+int Code::operands(quint8 op)
+{
+    return op < MaxOp ? s_operands[op] : 0;
+}
+
+QStringList Code::disassemble() const
+{
+    QStringList res;
+    res << QString("%1 nargs %2 npvars %3 stack %4 bytes %5").arg(Project::decode(Token::getSymbolById(atom)))
+           .arg(nargs).arg(npvars).arg(maxStack).arg(ops.size());
+    int pc = 0;
+    while( pc < ops.size() )
+    {
+        const quint8 op = ops[pc];
+        const char* p = ops.constData() + pc + 1;
+        QString line = QString("%1  %2").arg(pc, 4, 10, QChar('0')).arg(name(op), -8);
+        switch( op )
+        {
+        case SIC:
+            line += QString::number(qint8(p[0]));
+            break;
+        case POPN:
+        case UNWIND:
+            line += QString::number(quint8(p[0]));
+            break;
+        case IVAR:
+        case IVARX_:
+        case PVAR:
+        case PVARX_:
+            {
+                const QVector<quint32>& names = op == IVAR || op == IVARX_ ? ivars : pvars;
+                const quint8 slot = p[0];
+                line += QString::number(slot);
+                if( slot < names.size() )
+                    line += QString(" ; %1").arg(Project::decode(Token::getSymbolById(names[slot])));
+            }
+            break;
+        case GCONST:
+            line += QString("%1 ; %2").arg(u16(p)).arg(Project::decode(consts.value(u16(p)).toString().left(40)));
+            break;
+        case GVAR:
+        case GVAR_:
+            line += Project::decode(Token::getSymbolById(atoms.value(u16(p))));
+            break;
+        case FN:
+            line += QString("%1 %2").arg(quint8(p[0])).arg(Project::decode(Token::getSymbolById(atoms.value(u16(p+1)))));
+            break;
+        case JUMP:
+        case FJUMP:
+        case TJUMP:
+        case NFJUMP:
+        case NTJUMP:
+            line += QString("%1").arg(pc + 3 + qint16(u16(p)), 4, 10, QChar('0'));
+            break;
+        }
+        res << line.trimmed();
+        pc += 1 + operands(op);
+    }
+    return res;
+}
+
+Compiler::Compiler():code(0),depth(0)
+{
+    nilAtom = idOf("NIL");
+    tAtom = idOf("T");
+    lambdaAtom = idOf("LAMBDA");
+
+    struct { const char* name; quint8 kind; } forms[] = {
+        { "QUOTE", Quote }, { "FUNCTION", Function }, { "SETQ", SetQ }, { "SETQQ", SetQQ },
+        { "COND", Cond }, { "PROGN", Progn }, { "PROG", Prog }, { "GO", Go }, { "RETURN", Return },
+        { "AND", And }, { "OR", Or }, { "SELECTQ", SelectQ }, { "LET", Let }, { "LET*", LetStar },
+        { "LAMBDA", Lambda }, { "NLAMBDA", Lambda }, { "CAR", Car }, { "CDR", Cdr }, { "CONS", Cons },
+        { "EQ", Eq }, { "LISTP", Listp }, { "IPLUS", IPlus }, { "IDIFFERENCE", IDifference },
+        { "ITIMES", ITimes }, { "IGREATERP", IGreaterp }, { "ILESSP", ILessp }, { "ADD1", Add1 },
+        { "SUB1", Sub1 }, { "ZEROP", Zerop }, { "NULL", Null }, { "NOT", Null }, { 0, 0 }
+    };
+    for( int i = 0; forms[i].name; i++ )
+        kinds[idOf(forms[i].name)] = forms[i].kind;
+}
+
+Code* Compiler::compile(quint32 name, const Object& lambda)
+{
+    error.clear();
+    vars.clear();
+    progs.clear();
+    depth = 0;
+    const Reader::List* l = lambda.type() == Object::List_ ? lambda.getList() : 0;
+    if( l == 0 || l->list.size() < 2 || l->list.first().getAtomId() != lambdaAtom )
+    {
+        fail("only LAMBDA expressions are compiled");
+        return 0;
+    }
+    code = new Code();
+    code->atom = name;
+    const Object& params = l->list[1];
+    if( params.type() == Object::List_ )
+    {
+        const Reader::List* p = params.getList();
+        for( int i = 0; i < p->list.size() && error.isEmpty(); i++ )
+        {
+            if( p->list[i].type() != Object::Atom_ || i > 255 )
+                fail("invalid parameter list");
+            vars.append(Var(p->list[i].getAtomId(), Code::IVAR, i));
+            code->ivars.append(p->list[i].getAtomId());
+        }
+        code->nargs = code->ivars.size();
+    }else if( params.type() == Object::Atom_ && params.getAtomId() != nilAtom )
+        fail("nospread functions are not compiled");
+    if( error.isEmpty() )
+        progn(l, 2);
+    if( error.isEmpty() )
+        gen(Code::RETURN);
+    Code* res = code;
+    code = 0;
+    if( !error.isEmpty() )
+    {
+        delete res;
+        return 0;
+    }
+    return res;
+}
+
+void Compiler::expr(const Object& f)
+{
+    switch( f.type() )
+    {
+    case Object::Atom_:
+        variable(f.getAtomId());
+        break;
+    case Object::List_:
+        list(f.getList());
+        break;
+    default:
+        literal(f);
+        break;
+    }
+}
+
+void Compiler::literal(const Object& o)
+{
+    if( o.type() == Object::Nil_ || o.getAtomId() == nilAtom ||
+            ( o.type() == Object::List_ && o.getList()->list.isEmpty() ) )
+        gen(Code::NIL);
+    else if( o.getAtomId() == tAtom )
+        gen(Code::T);
+    else if( o.type() == Object::Integer && o.getInt() >= -128 && o.getInt() <= 127 )
+        gen1(Code::SIC, quint8(qint8(o.getInt())));
+    else
+        gen2(Code::GCONST, index(o));
+}
+
+void Compiler::variable(quint32 atom)
+{
+    if( atom == nilAtom )
+        gen(Code::NIL);
+    else if( atom == tAtom )
+        gen(Code::T);
+    else
+    {
+        for( int i = vars.size() - 1; i >= 0; i-- )
+        {
+            if( vars[i].atom == atom )
+            {
+                gen1(vars[i].op, vars[i].slot);
+                return;
+            }
+        }
+        gen2(Code::GVAR, atomIndex(atom));
+    }
+}
+
+void Compiler::assign(quint32 atom)
+{
+    if( atom == nilAtom || atom == tAtom )
+        return fail("cannot set NIL or T");
+    for( int i = vars.size() - 1; i >= 0; i-- )
+    {
+        if( vars[i].atom == atom )
+        {
+            gen1(vars[i].op == Code::IVAR ? Code::IVARX_ : Code::PVARX_, vars[i].slot);
+            return;
+        }
+    }
+    gen2(Code::GVAR_, atomIndex(atom));
+}
+
+void Compiler::list(const Reader::List* l)
+{
+    if( l->list.isEmpty() )
+        return gen(Code::NIL);
+    const Object& head = l->list.first();
+    if( head.type() == Object::List_ )
+        return inlineLambda(head.getList(), l);
+    if( head.type() != Object::Atom_ )
+        return fail(QString("illegal function %1").arg(head.toString().constData()));
+    const int n = l->list.size() - 1; // number of args
+    switch( kinds.value(head.getAtomId(), Call) )
+    {
+    case Quote:
+    case Function:
+        return literal(n > 0 ? l->list[1] : Object());
+    case Lambda:
+        return gen2(Code::GCONST, index(Object(const_cast<Reader::List*>(l))));
+    case SetQ:
+    case SetQQ:
+        if( n < 1 || l->list[1].type() != Object::Atom_ )
+            return fail("SETQ needs an atom");
+        if( n < 2 )
+            gen(Code::NIL);
+        else if( kinds.value(head.getAtomId()) == SetQ )
+            expr(l->list[2]);
+        else
+            literal(l->list[2]);
+        return assign(l->list[1].getAtomId());
+    case Cond:
+        return cond(l);
+    case Progn:
+        return progn(l, 1);
+    case Prog:
+        return prog(l);
+    case Go:
+        return go(l);
+    case Return:
+        return ret(l);
+    case And:
+        return andOr(l, true);
+    case Or:
+        return andOr(l, false);
+    case SelectQ:
+        return selectq(l);
+    case Let:
+        return let(l, false);
+    case LetStar:
+        return let(l, true);
+    case Car:
+    case Cdr:
+    case Listp:
+        if( n != 1 )
+            return call(l);
+        expr(l->list[1]);
+        switch( kinds.value(head.getAtomId()) )
+        {
+        case Car:
+            return gen(Code::CAR);
+        case Cdr:
+            return gen(Code::CDR);
+        default:
+            return gen(Code::LISTP);
+        }
+    case Null:
+    case Zerop:
+        if( n != 1 )
+            return call(l);
+        // both are defined as EQ tests in Interlisp
+        expr(l->list[1]);
+        if( kinds.value(head.getAtomId()) == Null )
+            gen(Code::NIL);
+        else
+            gen1(Code::SIC, 0);
+        return gen(Code::EQ);
+    case Add1:
+    case Sub1:
+        if( n != 1 )
+            return call(l);
+        expr(l->list[1]);
+        gen1(Code::SIC, 1);
+        return gen(kinds.value(head.getAtomId()) == Add1 ? Code::IPLUS2 : Code::IDIFFERENCE);
+    case Cons:
+        if( n < 1 || n > 2 )
+            return call(l);
+        args(l);
+        if( n == 1 )
+            gen(Code::NIL);
+        return gen(Code::CONS);
+    case Eq:
+    case IDifference:
+    case IGreaterp:
+    case ILessp:
+        if( n != 2 )
+            return call(l);
+        args(l);
+        switch( kinds.value(head.getAtomId()) )
+        {
+        case Eq:
+            return gen(Code::EQ);
+        case IDifference:
+            return gen(Code::IDIFFERENCE);
+        case IGreaterp:
+            return gen(Code::IGREATERP);
+        default:
+            // (ILESSP A B) is (IGREATERP B A) as in the Interlisp-D compiler
+            gen(Code::SWAP);
+            return gen(Code::IGREATERP);
+        }
+    case IPlus:
+    case ITimes:
+        {
+            const bool plus = kinds.value(head.getAtomId()) == IPlus;
+            if( n < 2 )
+                return call(l);
+            expr(l->list[1]);
+            for( int i = 2; i <= n; i++ )
+            {
+                expr(l->list[i]);
+                gen(plus ? Code::IPLUS2 : Code::ITIMES2);
+            }
+            return;
+        }
+    default:
+        return call(l);
+    }
+}
+
+void Compiler::call(const Reader::List* l)
+{
+    const int n = l->list.size() - 1;
+    if( n > 255 )
+        return fail("too many arguments");
+    args(l);
+    gen1(Code::FN, n);
+    code->ops.append(char(0));
+    code->ops.append(char(0));
+    const quint16 i = atomIndex(l->list.first().getAtomId());
+    code->ops[code->ops.size()-2] = char(i >> 8);
+    code->ops[code->ops.size()-1] = char(i & 0xff);
+    depth += 1 - n;
+}
+
+void Compiler::args(const Reader::List* l, int from)
+{
+    for( int i = from; i < l->list.size() && error.isEmpty(); i++ )
+        expr(l->list[i]);
+}
+
+void Compiler::progn(const Reader::List* l, int from)
+{
+    if( from >= l->list.size() )
+        return gen(Code::NIL);
+    for( int i = from; i < l->list.size() && error.isEmpty(); i++ )
+    {
+        expr(l->list[i]);
+        if( i < l->list.size() - 1 )
+            gen(Code::POP);
+    }
+}
+
+void Compiler::cond(const Reader::List* l)
+{
+    const int base = depth;
+    QList<int> ends;
+    for( int i = 1; i < l->list.size() && error.isEmpty(); i++ )
+    {
+        if( l->list[i].type() != Object::List_ || l->list[i].getList()->list.isEmpty() )
+            continue;
+        const Reader::List* c = l->list[i].getList();
+        expr(c->list.first());
+        if( c->list.size() == 1 )
+            ends << jump(Code::NTJUMP); // the test is the value
+        else
+        {
+            const int next = jump(Code::FJUMP);
+            progn(c, 1);
+            ends << jump(Code::JUMP);
+            depth = base;
+            patch(next, code->ops.size());
+        }
+    }
+    gen(Code::NIL);
+    foreach( int at, ends )
+        patch(at, code->ops.size());
+}
+
+void Compiler::andOr(const Reader::List* l, bool isAnd)
+{
+    const int n = l->list.size();
+    if( n == 1 )
+        return gen(isAnd ? Code::T : Code::NIL);
+    QList<int> ends;
+    for( int i = 1; i < n - 1 && error.isEmpty(); i++ )
+    {
+        expr(l->list[i]);
+        ends << jump(isAnd ? Code::NFJUMP : Code::NTJUMP);
+    }
+    expr(l->list[n-1]);
+    foreach( int at, ends )
+        patch(at, code->ops.size());
+}
+
+void Compiler::prog(const Reader::List* l)
+{
+    const int mark = vars.size();
+    if( l->list.size() > 1 && l->list[1].type() == Object::List_ )
+    {
+        // the slots are reset each time the PROG is entered; like the Evaluator the inits are sequential
+        const Reader::List* v = l->list[1].getList();
+        for( int i = 0; i < v->list.size() && error.isEmpty(); i++ )
+        {
+            quint32 atom = v->list[i].getAtomId();
+            if( v->list[i].type() == Object::List_ && !v->list[i].getList()->list.isEmpty() )
+            {
+                const Reader::List* b = v->list[i].getList();
+                atom = b->list.first().getAtomId();
+                if( b->list.size() > 1 )
+                    expr(b->list[1]);
+                else
+                    gen(Code::NIL);
+            }else
+                gen(Code::NIL);
+            if( atom == 0 )
+                return fail("invalid PROG variable");
+            const quint8 slot = newPvar(atom);
+            gen1(Code::PVARX_, slot);
+            gen(Code::POP);
+            vars.append(Var(atom, Code::PVAR, slot));
+        }
+    }
+    ProgScope p;
+    p.depth = depth;
+    for( int i = 2; i < l->list.size(); i++ )
+    {
+        if( l->list[i].type() == Object::Atom_ )
+            p.labels.append(Label(l->list[i].getAtomId()));
+    }
+    progs.append(p);
+    const int me = progs.size() - 1;
+    for( int i = 2; i < l->list.size() && error.isEmpty(); i++ )
+    {
+        if( l->list[i].type() == Object::Atom_ )
+        {
+            for( int j = 0; j < progs[me].labels.size(); j++ )
+            {
+                if( progs[me].labels[j].atom == l->list[i].getAtomId() && progs[me].labels[j].pc < 0 )
+                {
+                    progs[me].labels[j].pc = code->ops.size();
+                    break;
+                }
+            }
+            continue;
+        }
+        expr(l->list[i]);
+        gen(Code::POP);
+    }
+    gen(Code::NIL);
+    if( error.isEmpty() )
+    {
+        foreach( const Fixup& f, progs[me].fixups )
+        {
+            if( f.label == 0 )
+                patch(f.at, code->ops.size());
+            else
+            {
+                for( int j = 0; j < progs[me].labels.size(); j++ )
+                {
+                    if( progs[me].labels[j].atom == f.label )
+                    {
+                        patch(f.at, progs[me].labels[j].pc);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    progs.removeLast();
+    vars.resize(mark);
+}
+
+void Compiler::go(const Reader::List* l)
+{
+    if( l->list.size() < 2 || l->list[1].type() != Object::Atom_ )
+        return fail("GO needs a label");
+    const quint32 label = l->list[1].getAtomId();
+    for( int i = progs.size() - 1; i >= 0; i-- )
+    {
+        for( int j = 0; j < progs[i].labels.size(); j++ )
+        {
+            if( progs[i].labels[j].atom != label )
+                continue;
+            const int before = depth;
+            if( depth > progs[i].depth )
+            {
+                gen1(Code::POPN, depth - progs[i].depth);
+                depth = progs[i].depth;
+            }
+            progs[i].fixups.append(Fixup(jump(Code::JUMP), label));
+            depth = before + 1; // GO has no value, but the code following it is compiled as if
+            return;
+        }
+    }
+    fail(QString("GO to unknown label %1").arg(Token::getSymbolById(label)));
+}
+
+void Compiler::ret(const Reader::List* l)
+{
+    if( progs.isEmpty() )
+        return fail("RETURN outside of PROG");
+    const int before = depth;
+    if( l->list.size() > 1 )
+        expr(l->list[1]);
+    else
+        gen(Code::NIL);
+    const int below = depth - 1 - progs.last().depth;
+    if( below > 0 )
+    {
+        gen1(Code::UNWIND, below);
+        depth -= below;
+    }
+    progs.last().fixups.append(Fixup(jump(Code::JUMP), 0));
+    depth = before + 1;
+}
+
+void Compiler::selectq(const Reader::List* l)
+{
+    const int n = l->list.size();
+    if( n < 2 )
+        return gen(Code::NIL);
+    const int base = depth;
+    expr(l->list[1]);
+    QList<int> ends;
+    for( int i = 2; i < n - 1 && error.isEmpty(); i++ )
+    {
+        if( l->list[i].type() != Object::List_ || l->list[i].getList()->list.isEmpty() )
+            continue;
+        const Reader::List* c = l->list[i].getList();
+        const Object& key = c->list.first();
+        QList<int> hits;
+        if( key.type() == Object::List_ )
+        {
+            const Reader::List* keys = key.getList();
+            for( int j = 0; j < keys->list.size(); j++ )
+            {
+                gen(Code::COPY);
+                literal(keys->list[j]);
+                gen(Code::EQ);
+                hits << jump(Code::TJUMP);
+            }
+        }else
+        {
+            gen(Code::COPY);
+            literal(key);
+            gen(Code::EQ);
+            hits << jump(Code::TJUMP);
+        }
+        const int next = jump(Code::JUMP);
+        foreach( int at, hits )
+            patch(at, code->ops.size());
+        gen(Code::POP);
+        progn(c, 1);
+        ends << jump(Code::JUMP);
+        depth = base + 1;
+        patch(next, code->ops.size());
+    }
+    gen(Code::POP);
+    if( n > 2 )
+        expr(l->list[n-1]);
+    else
+        gen(Code::NIL);
+    foreach( int at, ends )
+        patch(at, code->ops.size());
+}
+
+void Compiler::let(const Reader::List* l, bool sequential)
+{
+    const int mark = vars.size();
+    if( l->list.size() > 1 && l->list[1].type() == Object::List_ )
+    {
+        // LET evaluates all inits on the stack before it stores them, LET* stores each directly
+        const Reader::List* v = l->list[1].getList();
+        QVector<quint32> atoms;
+        for( int i = 0; i < v->list.size() && error.isEmpty(); i++ )
+        {
+            quint32 atom = v->list[i].getAtomId();
+            if( v->list[i].type() == Object::List_ && !v->list[i].getList()->list.isEmpty() )
+            {
+                const Reader::List* b = v->list[i].getList();
+                atom = b->list.first().getAtomId();
+                if( b->list.size() > 1 )
+                    expr(b->list[1]);
+                else
+                    gen(Code::NIL);
+            }else
+                gen(Code::NIL);
+            if( atom == 0 )
+                return fail("invalid LET variable");
+            if( sequential )
+            {
+                const quint8 slot = newPvar(atom);
+                gen1(Code::PVARX_, slot);
+                gen(Code::POP);
+                vars.append(Var(atom, Code::PVAR, slot));
+            }else
+                atoms.append(atom);
+        }
+        QVector<quint8> slotOf(atoms.size());
+        for( int i = 0; i < atoms.size(); i++ )
+            slotOf[i] = newPvar(atoms[i]);
+        for( int i = atoms.size() - 1; i >= 0; i-- )
+        {
+            gen1(Code::PVARX_, slotOf[i]);
+            gen(Code::POP);
+        }
+        for( int i = 0; i < atoms.size(); i++ )
+            vars.append(Var(atoms[i], Code::PVAR, slotOf[i]));
+    }
+    progn(l, 2);
+    vars.resize(mark);
+}
+
+void Compiler::inlineLambda(const Reader::List* lambda, const Reader::List* form)
+{
+    // ((LAMBDA (X Y) ...) a b) is compiled like a LET
+    if( lambda->list.size() < 2 || lambda->list.first().getAtomId() != lambdaAtom ||
+            ( lambda->list[1].type() != Object::List_ && lambda->list[1].getAtomId() != nilAtom ) )
+        return fail("only LAMBDA with a parameter list can be compiled inline");
+    const int mark = vars.size();
+    const int n = form->list.size() - 1;
+    args(form);
+    QVector<quint32> params;
+    if( lambda->list[1].type() == Object::List_ )
+    {
+        const Reader::List* p = lambda->list[1].getList();
+        for( int i = 0; i < p->list.size(); i++ )
+            params.append(p->list[i].getAtomId());
+    }
+    for( int i = n; i < params.size(); i++ )
+        gen(Code::NIL);
+    if( n > params.size() )
+    {
+        // the surplus args were evaluated for their side effects
+        for( int i = params.size(); i < n; i++ )
+            gen(Code::POP);
+    }
+    QVector<quint8> slotOf(params.size());
+    for( int i = 0; i < params.size(); i++ )
+        slotOf[i] = newPvar(params[i]);
+    for( int i = params.size() - 1; i >= 0; i-- )
+    {
+        gen1(Code::PVARX_, slotOf[i]);
+        gen(Code::POP);
+    }
+    for( int i = 0; i < params.size(); i++ )
+        vars.append(Var(params[i], Code::PVAR, slotOf[i]));
+    progn(lambda, 2);
+    vars.resize(mark);
+}
+
+quint8 Compiler::newPvar(quint32 atom)
+{
+    if( code->pvars.size() >= 255 )
+    {
+        fail("too many variables");
+        return 0;
+    }
+    code->pvars.append(atom);
+    code->npvars = code->pvars.size();
+    return code->pvars.size() - 1;
+}
+
+quint16 Compiler::index(const Object& o)
+{
+    for( int i = 0; i < code->consts.size(); i++ )
+    {
+        if( code->consts[i].isSame(o) )
+            return i;
+    }
+    if( code->consts.size() > 0xffff )
+        fail("too many constants");
+    code->consts.append(o);
+    return code->consts.size() - 1;
+}
+
+quint16 Compiler::atomIndex(quint32 atom)
+{
+    const int i = code->atoms.indexOf(atom);
+    if( i >= 0 )
+        return i;
+    if( code->atoms.size() > 0xffff )
+        fail("too many atoms");
+    code->atoms.append(atom);
+    return code->atoms.size() - 1;
+}
+
+void Compiler::gen(quint8 op)
+{
+    code->ops.append(char(op));
+    depth += s_effects[op];
+    if( depth > code->maxStack )
+        code->maxStack = depth;
+}
+
+void Compiler::gen1(quint8 op, quint8 a)
+{
+    gen(op);
+    code->ops.append(char(a));
+}
+
+void Compiler::gen2(quint8 op, quint16 a)
+{
+    gen(op);
+    code->ops.append(char(a >> 8));
+    code->ops.append(char(a & 0xff));
+}
+
+int Compiler::jump(quint8 op)
+{
+    gen2(op, 0);
+    return code->ops.size() - 2;
+}
+
+void Compiler::patch(int at, int target)
+{
+    const int off = target - ( at + 2 ); // relative to the next instruction
+    if( off < -32768 || off > 32767 )
+        return fail("function too large");
+    code->ops[at] = char(quint16(off) >> 8);
+    code->ops[at+1] = char(quint16(off) & 0xff);
+}
+
+void Compiler::fail(const QString& msg)
+{
+    if( error.isEmpty() )
+        error = msg;
+}
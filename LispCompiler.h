@@ -0,0 +1,144 @@
+#ifndef LISPCOMPILER_H
+#define LISPCOMPILER_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include <QHash>
+#include <QStringList>
+#include "LispReader.h"
+
+namespace Lisp
+{
+
+// The opcodes, their operand bytes and their effect on the stack depth; the names and the split
+// into IVAR (arguments), PVAR (PROG and LET variables) and GVAR (free variables) follow the
+// Interlisp-D instruction set. Variable slots, SIC and argument counts are one byte, GCONST
+// and atom indices as well as the signed jump distances two bytes, high byte first.
+#define LISP_OPCODES(X) \
+    X(NIL,0,1) X(T,0,1) X(SIC,1,1) X(GCONST,2,1) X(COPY,0,1) X(POP,0,-1) X(POPN,1,0) X(UNWIND,1,0) \
+    X(SWAP,0,0) X(IVAR,1,1) X(PVAR,1,1) X(GVAR,2,1) X(IVARX_,1,0) X(PVARX_,1,0) X(GVAR_,2,0) \
+    X(JUMP,2,0) X(FJUMP,2,-1) X(TJUMP,2,-1) X(NFJUMP,2,-1) X(NTJUMP,2,-1) X(FN,3,0) X(RETURN,0,-1) \
+    X(CAR,0,0) X(CDR,0,0) X(CONS,0,-1) X(EQ,0,-1) X(LISTP,0,0) \
+    X(IPLUS2,0,-1) X(IDIFFERENCE,0,-1) X(ITIMES2,0,-1) X(IGREATERP,0,-1)
+
+// The bytecode of a compiled LAMBDA. Arguments occupy the first nargs slots of a frame, the
+// PROG and LET variables the following npvars, and the expression stack needs at most maxStack
+// slots above them.
+struct Code
+{
+#define LISP_OP_ENUM(name, len, effect) name,
+    enum Op { LISP_OPCODES(LISP_OP_ENUM) MaxOp };
+#undef LISP_OP_ENUM
+
+    QByteArray ops;
+    QVector<qintptr> threaded; // ops translated by the Machine if it uses direct threaded code
+    QVector<Reader::Object> consts; // GCONST; a Machine replaces the quoted lists by their cells
+    QVector<quint32> atoms; // atom ids of GVAR, GVAR_ and FN
+    QVector<quint32> ivars, pvars; // atom ids of the variables, only used by the disassembler
+    quint32 atom; // the name of the function
+    quint8 nargs, npvars;
+    quint16 maxStack;
+
+    Code():atom(0),nargs(0),npvars(0),maxStack(0){}
+    QStringList disassemble() const;
+    static const char* name(quint8 op);
+    static int operands(quint8 op);
+};
+
+// Compiles a LAMBDA with a parameter list to Code. Bound variables become frame slots as with the
+// LOCALVARS default of the Interlisp compiler, i.e. they are not visible to called functions;
+// all other variables are GVARs. NLAMBDA and nospread functions are left to the Evaluator.
+class Compiler
+{
+public:
+    typedef Reader::Object Object;
+
+    Compiler();
+    Code* compile(quint32 name, const Object& lambda); // the caller owns the result, 0 on error
+    const QString& getError() const { return error; }
+private:
+    enum Kind { Call, Quote, Function, SetQ, SetQQ, Cond, Progn, Prog, Go, Return, And, Or, SelectQ,
+                Let, LetStar, Lambda, Car, Cdr, Cons, Eq, Listp, IPlus, IDifference, ITimes,
+                IGreaterp, ILessp, Add1, Sub1, Zerop, Null };
+    struct Var
+    {
+        quint32 atom;
+        quint8 op; // IVAR or PVAR
+        quint8 slot;
+        Var(quint32 a = 0, quint8 o = 0, quint8 s = 0):atom(a),op(o),slot(s){}
+    };
+    struct Label
+    {
+        quint32 atom;
+        int pc; // -1 until emitted
+        Label(quint32 a = 0):atom(a),pc(-1){}
+    };
+    struct Fixup
+    {
+        int at; // of the jump operand
+        quint32 label; // 0 for the exit of the PROG
+        Fixup(int a = 0, quint32 l = 0):at(a),label(l){}
+    };
+    struct ProgScope
+    {
+        int depth; // of the stack at the statements
+        QList<Label> labels;
+        QList<Fixup> fixups;
+    };
+    void expr(const Object&);
+    void literal(const Object&);
+    void variable(quint32 atom);
+    void assign(quint32 atom);
+    void list(const Reader::List*);
+    void call(const Reader::List*);
+    void args(const Reader::List*, int from = 1);
+    void progn(const Reader::List*, int from);
+    void cond(const Reader::List*);
+    void andOr(const Reader::List*, bool isAnd);
+    void prog(const Reader::List*);
+    void go(const Reader::List*);
+    void ret(const Reader::List*);
+    void selectq(const Reader::List*);
+    void let(const Reader::List*, bool sequential);
+    void inlineLambda(const Reader::List* lambda, const Reader::List* form);
+    quint8 newPvar(quint32 atom);
+    quint16 index(const Object&);
+    quint16 atomIndex(quint32);
+    void gen(quint8 op);
+    void gen1(quint8 op, quint8);
+    void gen2(quint8 op, quint16);
+    int jump(quint8 op); // returns the position of the operand
+    void patch(int at, int target);
+    void fail(const QString&);
+
+    QHash<quint32,quint8> kinds;
+    quint32 nilAtom, tAtom, lambdaAtom;
+    Code* code;
+    QVector<Var> vars;
+    QList<ProgScope> progs;
+    int depth;
+    QString error;
+};
+
+}
+
+#endif // LISPCOMPILER_H
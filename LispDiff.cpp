@@ -0,0 +1,359 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include "LispDiff.h"
+#include "LispProject.h"
+#include "LispLexer.h"
+#include "LispTrace.h"
+#include <QFileInfo>
+#include <QHash>
+#include <QVector>
+using namespace Lisp;
+
+static inline Diff::Hash mix(Diff::Hash h, Diff::Hash v)
+{
+    return h ^ ( v + Q_UINT64_C(0x9e3779b97f4a7c15) + ( h << 6 ) + ( h >> 2 ) );
+}
+
+static Diff::Hash fnv(const QByteArray& str)
+{
+    Diff::Hash h = Q_UINT64_C(0xcbf29ce484222325);
+    for( int i = 0; i < str.size(); i++ )
+    {
+        h ^= quint8(str[i]);
+        h *= Q_UINT64_C(0x100000001b3);
+    }
+    return h;
+}
+
+Diff::Diff():unchanged(0)
+{
+
+}
+
+enum { ListSeed = 1, StringSeed = 2, ValueSeed = 3 };
+
+Diff::Hash Diff::hash(const Reader::Object& o)
+{
+    // a list hashes the hashes of its elements, so equal subtrees have equal hashes
+    switch( o.type() )
+    {
+    case Reader::Object::List_: {
+            const Reader::List* l = o.getList();
+            Hash h = mix(ListSeed, l->list.size());
+            for( int i = 0; i < l->list.size(); i++ )
+                h = mix(h, hash(l->list[i]));
+            return h;
+        }
+    case Reader::Object::String_:
+        return mix(StringSeed, fnv(o.getStr()->str));
+    default:
+        return mix(ValueSeed, o.identity());
+    }
+}
+
+static Diff::Hash bodyHash(const Reader::List* fun)
+{
+    // the definition without the name, so a renamed function keeps its hash
+    Diff::Hash h = mix(ListSeed, fun->list.size() - 1);
+    for( int i = 1; i < fun->list.size(); i++ )
+        h = mix(h, Diff::hash(fun->list[i]));
+    return h;
+}
+
+static QString fileKey(const QString& path)
+{
+    // the same file usually has the same name in all releases, but not the same directory
+    return Project::debang(QFileInfo(path).fileName()).toUpper();
+}
+
+void Diff::collect(const Project& prj, Defs& functions, Defs& forms)
+{
+    Trace::Span span("collect", prj.root);
+    const quint32 defineq = Token::getSymbolId(Token::getSymbol("DEFINEQ").constData());
+    const quint32 filecreated = Token::getSymbolId(Token::getSymbol("FILECREATED").constData());
+    QMap<QString,Reader::Object>::const_iterator i;
+    for( i = prj.asts.begin(); i != prj.asts.end(); ++i )
+    {
+        if( i.value().type() != Reader::Object::List_ )
+            continue;
+        const Reader::List* top = i.value().getList();
+        const QString file = fileKey(i.key());
+        for( int j = 0; j < top->list.size(); j++ )
+        {
+            if( top->list[j].type() != Reader::Object::List_ )
+                continue;
+            const Reader::List* form = top->list[j].getList();
+            const quint32 pos = j < top->elementPositions.size() ? top->elementPositions[j] : NoPos;
+            const quint32 head = form->list.isEmpty() ? 0 : form->list.first().getAtomId();
+            if( head == filecreated )
+                continue; // only dates and file history, which always differ
+            if( head == defineq )
+            {
+                for( int k = 1; k < form->list.size(); k++ )
+                {
+                    const Reader::Object& fun = form->list[k];
+                    if( fun.type() != Reader::Object::List_ || fun.getList()->list.isEmpty() ||
+                            fun.getList()->list.first().type() != Reader::Object::Atom_ )
+                        continue;
+                    Def d;
+                    d.file = i.key();
+                    d.pos = k < form->elementPositions.size() ? form->elementPositions[k] : pos;
+                    d.form = fun;
+                    d.hash = bodyHash(fun.getList());
+                    // a later definition of the same function wins, as when loading the files
+                    functions[fun.getList()->list.first().getAtom()] = d;
+                }
+                continue;
+            }
+            QByteArray key = file.toUtf8();
+            if( head )
+                key += " " + form->list.first().toString();
+            if( form->list.size() > 1 && form->list[1].type() == Reader::Object::Atom_ )
+                key += " " + form->list[1].toString();
+            const QByteArray base = key;
+            for( int n = 2; forms.contains(key); n++ )
+                key = base + " #" + QByteArray::number(n);
+            Def d;
+            d.file = i.key();
+            d.pos = pos;
+            d.form = top->list[j];
+            d.hash = hash(d.form);
+            forms[key] = d;
+        }
+    }
+}
+
+void Diff::compare(const Project& lhs, const Project& rhs)
+{
+    Trace::Span span("diff");
+    changes.clear();
+    unchanged = 0;
+    Defs lf, lt, rf, rt;
+    collect(lhs, lf, lt);
+    collect(rhs, rf, rt);
+    compare(lf, rf, true);
+    compare(lt, rt, false);
+}
+
+void Diff::compare(const Defs& lhs, const Defs& rhs, bool functions)
+{
+    QList<Change> removed;
+    Defs::const_iterator i;
+    for( i = lhs.begin(); i != lhs.end(); ++i )
+    {
+        Defs::const_iterator j = rhs.find(i.key());
+        Change c;
+        c.function = functions;
+        c.name = i.key();
+        c.lhs = i.value();
+        if( j == rhs.end() )
+        {
+            c.kind = Removed;
+            removed << c;
+            continue;
+        }
+        c.rhs = j.value();
+        if( i.value().hash == j.value().hash )
+        {
+            if( functions && fileKey(i.value().file) != fileKey(j.value().file) )
+            {
+                c.kind = Moved;
+                changes << c;
+            }else
+                unchanged++;
+        }else
+        {
+            c.kind = Changed;
+            changes << c;
+        }
+    }
+
+    // an added definition with the same hash as a removed one is reported as renamed
+    QMultiHash<Hash,QByteArray> added;
+    for( i = rhs.begin(); i != rhs.end(); ++i )
+    {
+        if( !lhs.contains(i.key()) )
+            added.insert(i.value().hash, i.key());
+    }
+    for( int k = 0; k < removed.size(); k++ )
+    {
+        Change& c = removed[k];
+        if( functions )
+        {
+            QMultiHash<Hash,QByteArray>::iterator j = added.find(c.lhs.hash);
+            if( j != added.end() )
+            {
+                c.kind = Renamed;
+                c.newName = j.value();
+                c.rhs = rhs.value(j.value());
+                added.erase(j);
+            }
+        }
+        changes << c;
+    }
+    QMultiHash<Hash,QByteArray>::const_iterator j;
+    for( j = added.begin(); j != added.end(); ++j )
+    {
+        Change c;
+        c.kind = Added;
+        c.function = functions;
+        c.name = j.value();
+        c.rhs = rhs.value(j.value());
+        changes << c;
+    }
+}
+
+static QByteArray excerpt(const Reader::Object& o, int max = 60)
+{
+    QByteArray str = o.toString(true).simplified();
+    if( str.size() > max )
+        str = str.left(max - 3) + "...";
+    return str;
+}
+
+static QByteArray step(const QByteArray& path, const Reader::Object& o, int index)
+{
+    // path steps are element indices, qualified by the head atom of the element if any
+    QByteArray res = path + "/" + QByteArray::number(index);
+    if( o.type() == Reader::Object::List_ && !o.getList()->list.isEmpty() &&
+            o.getList()->list.first().type() == Reader::Object::Atom_ )
+        res += ":" + o.getList()->list.first().toString();
+    return res;
+}
+
+typedef QHash<const Reader::List*,Diff::Hash> HashCache;
+
+static Diff::Hash cachedHash(const Reader::Object& o, HashCache& cache)
+{
+    // like Diff::hash, but each list is only hashed once while descending
+    if( o.type() != Reader::Object::List_ )
+        return Diff::hash(o);
+    const Reader::List* l = o.getList();
+    HashCache::const_iterator i = cache.constFind(l);
+    if( i != cache.constEnd() )
+        return i.value();
+    Diff::Hash h = mix(ListSeed, l->list.size());
+    for( int k = 0; k < l->list.size(); k++ )
+        h = mix(h, cachedHash(l->list[k], cache));
+    cache.insert(l, h);
+    return h;
+}
+
+static void diffNodes(const Reader::Object& a, const Reader::Object& b, Diff::Hash ha, Diff::Hash hb,
+                      const QByteArray& path, QStringList& out, int max, HashCache& cache)
+{
+    if( out.size() >= max || ha == hb )
+        return;
+    if( a.type() != Reader::Object::List_ || b.type() != Reader::Object::List_ )
+    {
+        out << QString("%1: %2 -> %3").arg(path.isEmpty() ? "/" : path.constData())
+               .arg(excerpt(a).constData()).arg(excerpt(b).constData());
+        return;
+    }
+    const Reader::List* la = a.getList();
+    const Reader::List* lb = b.getList();
+    QVector<Diff::Hash> ea(la->list.size()), eb(lb->list.size());
+    for( int i = 0; i < ea.size(); i++ )
+        ea[i] = cachedHash(la->list[i], cache);
+    for( int i = 0; i < eb.size(); i++ )
+        eb[i] = cachedHash(lb->list[i], cache);
+
+    // skip the common prefix and suffix; what remains is either compared pairwise or replaced
+    int prefix = 0;
+    while( prefix < ea.size() && prefix < eb.size() && ea[prefix] == eb[prefix] )
+        prefix++;
+    int suffix = 0;
+    while( suffix < ea.size() - prefix && suffix < eb.size() - prefix &&
+           ea[ea.size() - 1 - suffix] == eb[eb.size() - 1 - suffix] )
+        suffix++;
+    const int na = ea.size() - prefix - suffix;
+    const int nb = eb.size() - prefix - suffix;
+    if( na == nb )
+    {
+        for( int i = prefix; i < prefix + na; i++ )
+            diffNodes(la->list[i], lb->list[i], ea[i], eb[i], step(path, la->list[i], i), out, max, cache);
+        return;
+    }
+    QByteArray lhs, rhs;
+    for( int i = prefix; i < prefix + na; i++ )
+        lhs += ( i == prefix ? "" : " " ) + excerpt(la->list[i], 30);
+    for( int i = prefix; i < prefix + nb; i++ )
+        rhs += ( i == prefix ? "" : " " ) + excerpt(lb->list[i], 30);
+    out << QString("%1 [%2]: %3 -> %4").arg(path.isEmpty() ? "/" : path.constData()).arg(prefix)
+           .arg(na ? lhs.constData() : "(nothing)").arg(nb ? rhs.constData() : "(nothing)");
+}
+
+QStringList Diff::subtreeDiff(const Reader::Object& lhs, const Reader::Object& rhs, int max)
+{
+    QStringList res;
+    HashCache cache;
+    diffNodes(lhs, rhs, cachedHash(lhs, cache), cachedHash(rhs, cache), QByteArray(), res, max, cache);
+    return res;
+}
+
+static QString where(const Diff::Def& d)
+{
+    return QFileInfo(d.file).fileName();
+}
+
+QStringList Diff::report(int maxDetails) const
+{
+    int count[2][Moved+1] = { { 0 } };
+    for( int i = 0; i < changes.size(); i++ )
+        count[changes[i].function][changes[i].kind]++;
+    QStringList res;
+    for( int f = 1; f >= 0; f-- )
+        res << QString("%1: %2 added, %3 removed, %4 changed, %5 renamed, %6 moved")
+               .arg(f ? "functions" : "top-level forms").arg(count[f][Added]).arg(count[f][Removed])
+               .arg(count[f][Changed]).arg(count[f][Renamed]).arg(count[f][Moved]);
+    res << QString("%1 definitions and forms unchanged").arg(unchanged);
+
+    for( int i = 0; i < changes.size(); i++ )
+    {
+        const Change& c = changes[i];
+        const QString name = QString::fromUtf8(c.name);
+        switch( c.kind )
+        {
+        case Added:
+            res << QString("+ %1 (%2)").arg(name).arg(where(c.rhs));
+            break;
+        case Removed:
+            res << QString("- %1 (%2)").arg(name).arg(where(c.lhs));
+            break;
+        case Renamed:
+            res << QString("> %1 -> %2 (%3)").arg(name).arg(QString::fromUtf8(c.newName)).arg(where(c.rhs));
+            break;
+        case Moved:
+            res << QString("> %1 (%2 -> %3)").arg(name).arg(where(c.lhs)).arg(where(c.rhs));
+            break;
+        case Changed:
+            res << QString("~ %1 (%2)").arg(name).arg(where(c.rhs));
+            if( maxDetails > 0 )
+            {
+                foreach( const QString& d, subtreeDiff(c.lhs.form, c.rhs.form, maxDetails) )
+                    res << "    " + d;
+            }
+            break;
+        }
+    }
+    return res;
+}
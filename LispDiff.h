@@ -0,0 +1,83 @@
+#ifndef LISPDIFF_H
+#define LISPDIFF_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include <QMap>
+#include <QStringList>
+#include "LispReader.h"
+
+namespace Lisp
+{
+
+class Project;
+
+// Compares two parsed source trees, e.g. two releases, by Merkle hashes of their forms.
+// DEFINEQ functions are matched by name across all files, the remaining top-level forms by
+// file name, head and first argument. Atoms are hashed by identity, so both projects have to
+// be parsed by the same process.
+class Diff
+{
+public:
+    typedef quint64 Hash;
+
+    struct Def
+    {
+        QString file;
+        quint32 pos; // offset in file, NoPos if unknown
+        Hash hash; // of a function without its name, so renamed functions can be recognized
+        Reader::Object form;
+        Def():pos(NoPos),hash(0){}
+    };
+    typedef QMap<QByteArray,Def> Defs; // name or form key -> definition
+
+    enum Kind { Added, Removed, Changed, Renamed, Moved };
+    struct Change
+    {
+        Kind kind;
+        bool function;
+        QByteArray name;
+        QByteArray newName; // only Renamed
+        Def lhs, rhs; // lhs is empty if Added, rhs if Removed
+        Change():kind(Changed),function(false){}
+    };
+
+    Diff();
+
+    void compare(const Project& lhs, const Project& rhs);
+    const QList<Change>& getChanges() const { return changes; }
+    int getUnchanged() const { return unchanged; }
+    QStringList report(int maxDetails = 10) const;
+
+    static Hash hash(const Reader::Object&);
+    static void collect(const Project&, Defs& functions, Defs& forms);
+    // paths and excerpts of the smallest differing subtrees
+    static QStringList subtreeDiff(const Reader::Object& lhs, const Reader::Object& rhs, int max = 10);
+private:
+    void compare(const Defs& lhs, const Defs& rhs, bool functions);
+    QList<Change> changes;
+    int unchanged;
+};
+
+}
+
+#endif // LISPDIFF_H
@@ -0,0 +1,1279 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include "LispEvaluator.h"
+#include "LispLexer.h"
+#include <QVarLengthArray>
+using namespace Lisp;
+
+typedef Reader::Object Object;
+
+enum { MaxDepth = 2000, // nested LAMBDA calls; each costs some C stack frames
+       MaxTemps = 1 << 16 };
+
+static quint32 idOf(const char* name)
+{
+    return Token::getSymbolId(Token::getSymbol(name).constData());
+}
+
+static bool toInt(Evaluator* e, const Object& o, qint64& i)
+{
+    if( o.type() == Object::Integer )
+        i = o.getInt();
+    else if( o.type() == Object::Float )
+        i = qint64(o.getDouble());
+    else
+    {
+        e->fail(QString("non-numeric arg %1").arg(o.toString().constData()));
+        return false;
+    }
+    return true;
+}
+
+static bool toDouble(Evaluator* e, const Object& o, double& d)
+{
+    if( o.type() == Object::Integer )
+        d = o.getInt();
+    else if( o.type() == Object::Float )
+        d = o.getDouble();
+    else
+    {
+        e->fail(QString("non-numeric arg %1").arg(o.toString().constData()));
+        return false;
+    }
+    return true;
+}
+
+static inline bool isNumber(const Object& o)
+{
+    return o.type() == Object::Integer || o.type() == Object::Float;
+}
+
+static inline Reader::Cons* next(const Reader::Cons* c)
+{
+    return c->cdr.type() == Object::Cons_ ? c->cdr.getCons() : 0;
+}
+
+static Reader::Cons* cell(Evaluator* e, const Object& o)
+{
+    // a list of the Reader, e.g. a LAMBDA of the source, is taken like a quoted one; 0 if no list
+    if( o.type() == Object::Cons_ )
+        return o.getCons();
+    if( o.type() != Object::List_ )
+        return 0;
+    const Object d = e->data(o);
+    return d.type() == Object::Cons_ ? d.getCons() : 0;
+}
+
+static inline Object tail(Evaluator* e, const Object& o)
+{
+    // what is stored as a cdr; all kinds of nil become NIL
+    return e->isNil(o) ? Object() : e->data(o);
+}
+
+static bool equal(Evaluator* e, const Object& a, const Object& b)
+{
+    if( a.isSame(b) || ( e->isNil(a) && e->isNil(b) ) )
+        return true;
+    if( isNumber(a) && isNumber(b) )
+    {
+        double x, y;
+        return toDouble(e, a, x) && toDouble(e, b, y) && x == y;
+    }
+    if( a.type() == Object::List_ || b.type() == Object::List_ )
+        return equal(e, e->data(a), e->data(b));
+    if( a.type() != b.type() )
+        return false;
+    if( a.type() == Object::String_ )
+        return a.getStr()->str == b.getStr()->str;
+    if( a.type() == Object::Cons_ )
+    {
+        // along the cdrs in a loop, only the cars recursively
+        const Reader::Cons* l = a.getCons();
+        const Reader::Cons* r = b.getCons();
+        while( l != r )
+        {
+            if( !equal(e, l->car, r->car) )
+                return false;
+            if( next(l) == 0 || next(r) == 0 )
+                return equal(e, l->cdr, r->cdr);
+            l = next(l);
+            r = next(r);
+        }
+        return true;
+    }
+    return false;
+}
+
+namespace Builtins
+{
+
+static Object car(Evaluator* e, const Object* a, int n)
+{
+    if( n < 1 || e->isNil(a[0]) )
+        return Object();
+    const Reader::Cons* c = cell(e, a[0]);
+    if( c == 0 )
+        return e->fail("CAR of a non-list");
+    return c->car;
+}
+
+static Object cdr(Evaluator* e, const Object* a, int n)
+{
+    if( n < 1 || e->isNil(a[0]) )
+        return Object();
+    const Reader::Cons* c = cell(e, a[0]);
+    if( c == 0 )
+        return e->fail("CDR of a non-list");
+    return c->cdr;
+}
+
+static Object cons(Evaluator* e, const Object* a, int n)
+{
+    return e->cons(n > 0 ? a[0] : Object(), n > 1 ? tail(e, a[1]) : Object());
+}
+
+static Object list(Evaluator* e, const Object* a, int n)
+{
+    Object res;
+    for( int i = n - 1; i >= 0; i-- )
+        res = e->cons(a[i], res);
+    return res;
+}
+
+static Object append(Evaluator* e, const Object* a, int n)
+{
+    // the cells of all but the last list are copied, the last one is shared
+    Object res;
+    Reader::Cons* last = 0;
+    for( int i = 0; i < n; i++ )
+    {
+        if( e->isNil(a[i]) )
+            continue;
+        if( i == n - 1 )
+        {
+            if( last )
+                last->cdr = tail(e, a[i]);
+            else
+                res = tail(e, a[i]);
+            break;
+        }
+        const Reader::Cons* c = cell(e, a[i]);
+        if( c == 0 )
+            return e->fail("APPEND of a non-list");
+        for( ; c; c = next(c) )
+        {
+            const Object o = e->cons(c->car, Object());
+            if( last )
+                last->cdr = o;
+            else
+                res = o;
+            last = o.getCons();
+        }
+    }
+    return res;
+}
+
+static Object length(Evaluator* e, const Object* a, int n)
+{
+    qint64 len = 0;
+    for( const Reader::Cons* c = n > 0 ? cell(e, a[0]) : 0; c; c = next(c) )
+        len++;
+    return Object(len);
+}
+
+static Object rplaca(Evaluator* e, const Object* a, int n)
+{
+    Reader::Cons* c = n < 2 ? 0 : cell(e, a[0]);
+    if( c == 0 )
+        return e->fail("RPLACA of a non-list");
+    c->car = a[1];
+    e->getHeap()->write(c);
+    return Object(c);
+}
+
+static Object rplacd(Evaluator* e, const Object* a, int n)
+{
+    Reader::Cons* c = n < 2 ? 0 : cell(e, a[0]);
+    if( c == 0 )
+        return e->fail("RPLACD of a non-list");
+    c->cdr = tail(e, a[1]);
+    e->getHeap()->write(c);
+    return Object(c);
+}
+
+static Object nconc(Evaluator* e, const Object* a, int n)
+{
+    // the last cell of each list is linked to the next non-empty one
+    Object res;
+    Reader::Cons* last = 0;
+    for( int i = 0; i < n; i++ )
+    {
+        if( e->isNil(a[i]) )
+            continue;
+        Reader::Cons* c = cell(e, a[i]);
+        if( c == 0 )
+            return e->fail("NCONC of a non-list");
+        if( last )
+        {
+            last->cdr = Object(c);
+            e->getHeap()->write(last);
+        }else
+            res = Object(c);
+        last = c;
+        while( next(last) )
+            last = next(last);
+    }
+    return res;
+}
+
+static Object null(Evaluator* e, const Object* a, int n)
+{
+    return e->boolean(n < 1 || e->isNil(a[0]));
+}
+
+static Object atom(Evaluator* e, const Object* a, int n)
+{
+    return e->boolean(n < 1 || ( a[0].type() != Object::Cons_ && a[0].type() != Object::List_ ) ||
+                      e->isNil(a[0]));
+}
+
+static Object listp(Evaluator* e, const Object* a, int n)
+{
+    return e->boolean(n > 0 && ( a[0].type() == Object::Cons_ ||
+                                 ( a[0].type() == Object::List_ && !e->isNil(a[0]) ) ));
+}
+
+static Object numberp(Evaluator* e, const Object* a, int n)
+{
+    return e->boolean(n > 0 && isNumber(a[0]));
+}
+
+static Object eq(Evaluator* e, const Object* a, int n)
+{
+    if( n < 2 )
+        return e->fail("EQ needs two args");
+    return e->boolean(a[0].isSame(a[1]) || ( e->isNil(a[0]) && e->isNil(a[1]) ));
+}
+
+static Object eqp(Evaluator* e, const Object* a, int n)
+{
+    if( n < 2 )
+        return e->fail("EQP needs two args");
+    if( isNumber(a[0]) && isNumber(a[1]) )
+        return e->boolean(equal(e, a[0], a[1]));
+    return eq(e, a, n);
+}
+
+static Object equalp(Evaluator* e, const Object* a, int n)
+{
+    if( n < 2 )
+        return e->fail("EQUAL needs two args");
+    return e->boolean(equal(e, a[0], a[1]));
+}
+
+static Object iplus(Evaluator* e, const Object* a, int n)
+{
+    qint64 res = 0, i;
+    for( int k = 0; k < n; k++ )
+    {
+        if( !toInt(e, a[k], i) )
+            return Object();
+        res += i;
+    }
+    return Object(res);
+}
+
+static Object itimes(Evaluator* e, const Object* a, int n)
+{
+    qint64 res = 1, i;
+    for( int k = 0; k < n; k++ )
+    {
+        if( !toInt(e, a[k], i) )
+            return Object();
+        res *= i;
+    }
+    return Object(res);
+}
+
+static Object idifference(Evaluator* e, const Object* a, int n)
+{
+    qint64 x, y;
+    if( n < 2 || !toInt(e, a[0], x) || !toInt(e, a[1], y) )
+        return e->fail("IDIFFERENCE needs two numbers");
+    return Object(x - y);
+}
+
+static Object iquotient(Evaluator* e, const Object* a, int n)
+{
+    qint64 x, y;
+    if( n < 2 || !toInt(e, a[0], x) || !toInt(e, a[1], y) )
+        return e->fail("IQUOTIENT needs two numbers");
+    if( y == 0 )
+        return e->fail("division by zero");
+    return Object(x / y);
+}
+
+static Object iremainder(Evaluator* e, const Object* a, int n)
+{
+    qint64 x, y;
+    if( n < 2 || !toInt(e, a[0], x) || !toInt(e, a[1], y) )
+        return e->fail("IREMAINDER needs two numbers");
+    if( y == 0 )
+        return e->fail("division by zero");
+    return Object(x % y);
+}
+
+static Object add1(Evaluator* e, const Object* a, int n)
+{
+    qint64 x;
+    if( n < 1 || !toInt(e, a[0], x) )
+        return e->fail("ADD1 needs a number");
+    return Object(x + 1);
+}
+
+static Object sub1(Evaluator* e, const Object* a, int n)
+{
+    qint64 x;
+    if( n < 1 || !toInt(e, a[0], x) )
+        return e->fail("SUB1 needs a number");
+    return Object(x - 1);
+}
+
+static Object zerop(Evaluator* e, const Object* a, int n)
+{
+    return e->boolean(n > 0 && isNumber(a[0]) && ( a[0].type() == Object::Integer ? a[0].getInt() == 0 :
+                                                                                   a[0].getDouble() == 0.0 ));
+}
+
+static Object minusp(Evaluator* e, const Object* a, int n)
+{
+    double x;
+    if( n < 1 || !toDouble(e, a[0], x) )
+        return e->fail("MINUSP needs a number");
+    return e->boolean(x < 0);
+}
+
+static Object ilessp(Evaluator* e, const Object* a, int n)
+{
+    qint64 x, y;
+    if( n < 2 || !toInt(e, a[0], x) || !toInt(e, a[1], y) )
+        return e->fail("ILESSP needs two numbers");
+    return e->boolean(x < y);
+}
+
+static Object igreaterp(Evaluator* e, const Object* a, int n)
+{
+    qint64 x, y;
+    if( n < 2 || !toInt(e, a[0], x) || !toInt(e, a[1], y) )
+        return e->fail("IGREATERP needs two numbers");
+    return e->boolean(x > y);
+}
+
+static Object arith(Evaluator* e, const Object* a, int n, char op)
+{
+    // the generic arithmetic stays in integers as long as all args are integers
+    bool floats = false;
+    for( int k = 0; k < n; k++ )
+    {
+        if( !isNumber(a[k]) )
+            return e->fail(QString("non-numeric arg %1").arg(a[k].toString().constData()));
+        floats = floats || a[k].type() == Object::Float;
+    }
+    if( n == 0 )
+        return Object(qint64(op == '*' ? 1 : 0));
+    if( floats )
+    {
+        double res;
+        toDouble(e, a[0], res);
+        for( int k = 1; k < n; k++ )
+        {
+            double d;
+            toDouble(e, a[k], d);
+            switch( op )
+            {
+            case '+': res += d; break;
+            case '-': res -= d; break;
+            case '*': res *= d; break;
+            }
+        }
+        return Object(res);
+    }
+    qint64 res = a[0].getInt();
+    for( int k = 1; k < n; k++ )
+    {
+        switch( op )
+        {
+        case '+': res += a[k].getInt(); break;
+        case '-': res -= a[k].getInt(); break;
+        case '*': res *= a[k].getInt(); break;
+        }
+    }
+    return Object(res);
+}
+
+static Object plus(Evaluator* e, const Object* a, int n)
+{
+    return arith(e, a, n, '+');
+}
+
+static Object difference(Evaluator* e, const Object* a, int n)
+{
+    return arith(e, a, n, '-');
+}
+
+static Object times(Evaluator* e, const Object* a, int n)
+{
+    return arith(e, a, n, '*');
+}
+
+static Object lessp(Evaluator* e, const Object* a, int n)
+{
+    double x, y;
+    if( n < 2 || !toDouble(e, a[0], x) || !toDouble(e, a[1], y) )
+        return e->fail("LESSP needs two numbers");
+    return e->boolean(x < y);
+}
+
+static Object greaterp(Evaluator* e, const Object* a, int n)
+{
+    double x, y;
+    if( n < 2 || !toDouble(e, a[0], x) || !toDouble(e, a[1], y) )
+        return e->fail("GREATERP needs two numbers");
+    return e->boolean(x > y);
+}
+
+static Object set(Evaluator* e, const Object* a, int n)
+{
+    if( n < 1 || a[0].type() != Object::Atom_ )
+        return e->fail("SET needs an atom");
+    const Object v = n > 1 ? a[1] : Object();
+    e->setValue(a[0].getAtomId(), v);
+    return v;
+}
+
+static Object getprop(Evaluator* e, const Object* a, int n)
+{
+    if( n < 2 || a[0].type() != Object::Atom_ || a[1].type() != Object::Atom_ )
+        return Object();
+    return e->getProperty(a[0].getAtomId(), a[1].getAtomId());
+}
+
+static Object putprop(Evaluator* e, const Object* a, int n)
+{
+    if( n < 2 || a[0].type() != Object::Atom_ || a[1].type() != Object::Atom_ )
+        return e->fail("PUTPROP needs two atoms");
+    const Object v = n > 2 ? a[2] : Object();
+    e->setProperty(a[0].getAtomId(), a[1].getAtomId(), v);
+    return v;
+}
+
+static Object eval(Evaluator* e, const Object* a, int n)
+{
+    return n > 0 ? e->eval(a[0]) : Object();
+}
+
+static Object apply(Evaluator* e, const Object* a, int n)
+{
+    if( n < 1 )
+        return e->fail("APPLY needs a function");
+    if( n < 2 || e->isNil(a[1]) )
+        return e->apply(a[0], 0, 0);
+    Reader::Cons* c = cell(e, a[1]);
+    if( c == 0 )
+        return e->fail("APPLY needs a list of args");
+    return e->apply(a[0], Object(c));
+}
+
+}
+
+Evaluator::Evaluator():tp(0),jump(NoJump),label(0),depth(0)
+{
+    temps.resize(MaxTemps);
+    nilAtom = idOf("NIL");
+    lambdaAtom = idOf("LAMBDA");
+    nlambdaAtom = idOf("NLAMBDA");
+    defineq = idOf("DEFINEQ");
+    rpaq = idOf("RPAQ");
+    rpaqq = idOf("RPAQQ");
+    t.setAtom(idOf("T"));
+    unbound.setAtom(idOf("NOBIND"));
+    heap.addRoots(this);
+
+    struct { const char* name; quint8 special; } specialForms[] = {
+        { "QUOTE", Quote }, { "FUNCTION", Function }, { "COND", Cond }, { "SETQ", SetQ },
+        { "SETQQ", SetQQ }, { "PROG", Prog }, { "PROGN", Progn }, { "GO", Go }, { "RETURN", Return },
+        { "AND", And }, { "OR", Or }, { "SELECTQ", SelectQ }, { "LET", Let }, { "LET*", LetStar },
+        { "LAMBDA", Lambda }, { "NLAMBDA", Lambda }, { 0, 0 }
+    };
+    for( int i = 0; specialForms[i].name; i++ )
+    {
+        const quint32 id = idOf(specialForms[i].name);
+        ensure();
+        specials[id] = specialForms[i].special;
+    }
+
+    addPrimitive("CAR", Builtins::car);
+    addPrimitive("CDR", Builtins::cdr);
+    addPrimitive("CONS", Builtins::cons);
+    addPrimitive("LIST", Builtins::list);
+    addPrimitive("APPEND", Builtins::append);
+    addPrimitive("LENGTH", Builtins::length);
+    addPrimitive("RPLACA", Builtins::rplaca);
+    addPrimitive("RPLACD", Builtins::rplacd);
+    addPrimitive("NCONC", Builtins::nconc);
+    addPrimitive("NULL", Builtins::null);
+    addPrimitive("NOT", Builtins::null);
+    addPrimitive("ATOM", Builtins::atom);
+    addPrimitive("LISTP", Builtins::listp);
+    addPrimitive("NUMBERP", Builtins::numberp);
+    addPrimitive("EQ", Builtins::eq);
+    addPrimitive("EQP", Builtins::eqp);
+    addPrimitive("EQUAL", Builtins::equalp);
+    addPrimitive("IPLUS", Builtins::iplus);
+    addPrimitive("IDIFFERENCE", Builtins::idifference);
+    addPrimitive("ITIMES", Builtins::itimes);
+    addPrimitive("IQUOTIENT", Builtins::iquotient);
+    addPrimitive("IREMAINDER", Builtins::iremainder);
+    addPrimitive("ADD1", Builtins::add1);
+    addPrimitive("SUB1", Builtins::sub1);
+    addPrimitive("ZEROP", Builtins::zerop);
+    addPrimitive("MINUSP", Builtins::minusp);
+    addPrimitive("ILESSP", Builtins::ilessp);
+    addPrimitive("IGREATERP", Builtins::igreaterp);
+    addPrimitive("PLUS", Builtins::plus);
+    addPrimitive("DIFFERENCE", Builtins::difference);
+    addPrimitive("TIMES", Builtins::times);
+    addPrimitive("LESSP", Builtins::lessp);
+    addPrimitive("GREATERP", Builtins::greaterp);
+    addPrimitive("SET", Builtins::set);
+    addPrimitive("GETPROP", Builtins::getprop);
+    addPrimitive("PUTPROP", Builtins::putprop);
+    addPrimitive("EVAL", Builtins::eval);
+    addPrimitive("APPLY", Builtins::apply);
+}
+
+void Evaluator::ensure()
+{
+    // atoms may have been read since the last call
+    const int count = Token::getSymbolCount();
+    if( atoms.size() >= count )
+        return;
+    const int old = atoms.size();
+    atoms.resize(count);
+    for( int i = old; i < count; i++ )
+        atoms[i].value = unbound;
+    functions.resize(count);
+    primitives.resize(count);
+    specials.resize(count);
+}
+
+void Evaluator::load(const Object& ast)
+{
+    ensure();
+    if( ast.type() != Object::List_ )
+        return;
+    const Reader::List* top = ast.getList();
+    for( int i = 0; i < top->list.size(); i++ )
+    {
+        if( top->list[i].type() != Object::List_ )
+            continue;
+        const Reader::List* form = top->list[i].getList();
+        if( form->list.size() < 2 )
+            continue;
+        const quint32 head = form->list.first().getAtomId();
+        if( head == defineq )
+        {
+            for( int j = 1; j < form->list.size(); j++ )
+            {
+                if( form->list[j].type() != Object::List_ )
+                    continue;
+                const Reader::List* def = form->list[j].getList();
+                if( def->list.size() == 2 && def->list.first().type() == Object::Atom_ )
+                    define(def->list.first().getAtomId(), def->list[1]);
+            }
+        }else if( ( head == rpaqq || head == rpaq ) && form->list[1].type() == Object::Atom_ )
+        {
+            const Object v = form->list.size() < 3 ? Object() :
+                                                     head == rpaqq ? data(form->list[2]) : run(form->list[2]);
+            setValue(form->list[1].getAtomId(), v);
+        }
+    }
+}
+
+void Evaluator::define(quint32 atom, const Object& lambda)
+{
+    ensure();
+    if( atom < quint32(functions.size()) )
+        functions[atom] = lambda;
+}
+
+void Evaluator::addPrimitive(const char* name, Evaluator::Primitive p)
+{
+    const quint32 id = idOf(name);
+    ensure();
+    primitives[id] = p;
+}
+
+Object Evaluator::getValue(quint32 atom) const
+{
+    if( isBound(atom) )
+        return atoms[atom].value;
+    return Object();
+}
+
+void Evaluator::setValue(quint32 atom, const Object& v)
+{
+    ensure();
+    if( atom < quint32(atoms.size()) )
+        atoms[atom].value = v;
+}
+
+const Object& Evaluator::getDefinition(quint32 atom) const
+{
+    static const Object nil;
+    if( atom < quint32(functions.size()) )
+        return functions[atom];
+    return nil;
+}
+
+Object Evaluator::getProperty(quint32 atom, quint32 prop) const
+{
+    if( atom < quint32(atoms.size()) )
+        return atoms[atom].props.value(Token::getSymbolById(prop));
+    return Object();
+}
+
+void Evaluator::setProperty(quint32 atom, quint32 prop, const Object& v)
+{
+    ensure();
+    if( atom < quint32(atoms.size()) )
+        atoms[atom].props[Token::getSymbolById(prop)] = v;
+}
+
+Object Evaluator::run(const Object& form)
+{
+    ensure();
+    heap.collectIfDue(); // nothing of the Evaluator is on the C stack here
+    error.clear();
+    jump = NoJump;
+    depth = 0;
+    Object res = eval(form);
+    if( jump != NoJump )
+        fail(jump == GoJump ? "GO outside of PROG" : "RETURN outside of PROG");
+    jump = NoJump;
+    result = Object();
+    unbind(0);
+    pop(0);
+    return error.isEmpty() ? res : Object();
+}
+
+Object Evaluator::eval(const Object& form)
+{
+    switch( form.type() )
+    {
+    case Object::Atom_:
+        {
+            const quint32 id = form.getAtomId();
+            if( id == nilAtom || form.isSame(t) )
+                return form;
+            if( id >= quint32(atoms.size()) )
+                ensure(); // read after the last run or apply
+            const Object& v = atoms[id].value;
+            if( v.isSame(unbound) )
+                return fail(QString("unbound atom %1").arg(form.getAtom()));
+            return v;
+        }
+    case Object::List_:
+        return evalList(form.getList());
+    case Object::Cons_:
+        {
+            // code built at runtime, e.g. by EVAL; a LAMBDA evaluates to itself like one of the source
+            const quint32 head = form.getCons()->car.getAtomId();
+            if( head == lambdaAtom || head == nlambdaAtom )
+                return form;
+            const int base = tp;
+            const Reader::List* l = elements(form);
+            const Object res = l ? evalList(l) : Object();
+            pop(base);
+            return res;
+        }
+    default:
+        return form; // numbers, strings and NIL evaluate to themselves
+    }
+}
+
+Object Evaluator::apply(const Object& fn, const Object* args, int count)
+{
+    ensure(); // also called by the Machine and by primitives, not only from run()
+    if( fn.type() == Object::Atom_ )
+    {
+        const quint32 id = fn.getAtomId();
+        if( id < quint32(primitives.size()) && primitives[id] )
+            return primitives[id](this, args, count);
+        if( id < quint32(functions.size()) && functions[id].type() == Object::List_ )
+        {
+            const int base = tp;
+            if( !reserve(1) )
+                return Object();
+            temps[base] = functions[id]; // in case the function is redefined while running
+            const Object res = applyLambda(temps[base].getList(), args, count);
+            pop(base);
+            return res;
+        }
+        return fail(QString("undefined function %1").arg(fn.getAtom()));
+    }
+    if( fn.type() == Object::List_ || fn.type() == Object::Cons_ )
+    {
+        const int base = tp;
+        const Reader::List* lambda = elements(fn);
+        const Object res = lambda ? applyLambda(lambda, args, count) : Object();
+        pop(base);
+        return res;
+    }
+    return fail("illegal function");
+}
+
+Object Evaluator::apply(const Object& fn, const Object& args)
+{
+    // the args are copied to temps, since the callee may change the list
+    int count = 0;
+    for( Object i = args; i.type() == Object::Cons_; i = i.getCons()->cdr )
+        count++;
+    const int base = tp;
+    if( !reserve(count) )
+        return Object();
+    Object i = args;
+    for( int k = 0; k < count; k++ )
+    {
+        temps[base + k] = i.getCons()->car;
+        i = i.getCons()->cdr;
+    }
+    const Object res = apply(fn, temps.constData() + base, count);
+    pop(base);
+    return res;
+}
+
+Object Evaluator::data(const Object& o)
+{
+    if( o.type() != Object::List_ )
+        return o;
+    const Reader::List* l = o.getList();
+    QHash<const Reader::List*,Quoted>::const_iterator i = quoted.constFind(l);
+    if( i != quoted.constEnd() )
+        return i.value().data;
+    const Object res = cells(l);
+    quoted.insert(l, Quoted(o, res));
+    return res;
+}
+
+Object Evaluator::cells(const Reader::List* l)
+{
+    // the Heap only collects at safe points, so res is not freed while the cells are added
+    Object res;
+    for( int i = l->list.size() - 1; i >= 0; i-- )
+    {
+        const Object& e = l->list[i];
+        res = cons(e.type() == Object::List_ ? cells(e.getList()) : e, res);
+    }
+    return res;
+}
+
+const Reader::List* Evaluator::elements(const Object& o)
+{
+    // cells are walked by index like the lists of the Reader; the vector shares the elements, so
+    // QUOTE returns the very cells of the code, and markRoots traces them while it is on temps
+    if( o.type() == Object::List_ )
+        return o.getList();
+    if( o.type() != Object::Cons_ || !reserve(1) )
+        return 0;
+    Reader::List* l = new Reader::List();
+    temps[tp-1] = Object(l);
+    for( Object i = o; i.type() == Object::Cons_; i = i.getCons()->cdr )
+        l->list.append(i.getCons()->car);
+    return l;
+}
+
+void Evaluator::markRoots(Heap* h)
+{
+    for( int i = 0; i < atoms.size(); i++ )
+    {
+        const Reader::Atom& a = atoms[i];
+        h->mark(a.value);
+        Reader::Properties::const_iterator j;
+        for( j = a.props.begin(); j != a.props.end(); ++j )
+            h->mark(j.value());
+        for( int k = 0; k < a.vector.size(); k++ )
+            h->mark(a.vector[k]);
+    }
+    for( int i = 0; i < functions.size(); i++ )
+        h->mark(functions[i]);
+    for( int i = 0; i < bindings.size(); i++ )
+        h->mark(bindings[i].old);
+    for( int i = 0; i < tp; i++ )
+    {
+        h->mark(temps[i]);
+        if( temps[i].type() == Object::List_ )
+        {
+            // the source of a function, or the elements of cells being evaluated
+            const Reader::List* l = temps[i].getList();
+            for( int k = 0; k < l->list.size(); k++ )
+                h->mark(l->list[k]);
+        }
+    }
+    QHash<const Reader::List*,Quoted>::const_iterator j;
+    for( j = quoted.constBegin(); j != quoted.constEnd(); ++j )
+        h->mark(j.value().data);
+    h->mark(result);
+}
+
+Object Evaluator::fail(const QString& msg)
+{
+    if( error.isEmpty() )
+        error = msg;
+    return Object();
+}
+
+bool Evaluator::reserve(int n)
+{
+    if( tp + n > temps.size() )
+    {
+        fail("stack overflow");
+        return false;
+    }
+    tp += n;
+    return true;
+}
+
+void Evaluator::unbind(int mark)
+{
+    for( int i = bindings.size() - 1; i >= mark; i-- )
+        atoms[bindings[i].atom].value = bindings[i].old;
+    bindings.resize(mark);
+}
+
+Object Evaluator::evalList(const Reader::List* l)
+{
+    if( l->list.isEmpty() )
+        return Object();
+    const Object& head = l->list.first();
+    if( head.type() == Object::List_ || head.type() == Object::Cons_ )
+    {
+        // ((LAMBDA ...) args)
+        const int base = tp;
+        const Reader::List* lambda = elements(head);
+        const Object res = lambda ? call(lambda, l) : Object();
+        pop(base);
+        return res;
+    }
+    if( head.type() != Object::Atom_ )
+        return fail(QString("illegal function %1").arg(head.toString().constData()));
+    const quint32 id = head.getAtomId();
+    if( id >= quint32(specials.size()) )
+        ensure();
+    if( specials[id] != NoSpecial )
+        return special(specials[id], l);
+    const Primitive p = primitives[id];
+    if( p )
+    {
+        const int count = l->list.size() - 1;
+        const int base = tp;
+        if( !reserve(count) )
+            return Object();
+        for( int i = 0; i < count; i++ )
+        {
+            temps[base + i] = eval(l->list[i+1]);
+            if( jump != NoJump || !error.isEmpty() )
+            {
+                pop(base);
+                return Object();
+            }
+        }
+        const Object res = p(this, temps.constData() + base, count);
+        pop(base);
+        return res;
+    }
+    if( functions[id].type() != Object::List_ )
+        return fail(QString("undefined function %1").arg(head.getAtom()));
+    const int base = tp;
+    if( !reserve(1) )
+        return Object();
+    temps[base] = functions[id]; // in case the function is redefined while running
+    const Object res = call(temps[base].getList(), l);
+    pop(base);
+    return res;
+}
+
+Object Evaluator::call(const Reader::List* lambda, const Reader::List* form)
+{
+    const quint32 kind = lambda->list.isEmpty() ? 0 : lambda->list.first().getAtomId();
+    if( kind != lambdaAtom && kind != nlambdaAtom )
+        return fail("illegal lambda expression");
+    const int count = form->list.size() - 1;
+    const int base = tp;
+    if( !reserve(count) )
+        return Object();
+    for( int i = 0; i < count; i++ )
+    {
+        if( kind == nlambdaAtom )
+            temps[base + i] = data(form->list[i+1]);
+        else
+        {
+            temps[base + i] = eval(form->list[i+1]);
+            if( jump != NoJump || !error.isEmpty() )
+            {
+                pop(base);
+                return Object();
+            }
+        }
+    }
+    const Object res = applyLambda(lambda, temps.constData() + base, count);
+    pop(base);
+    return res;
+}
+
+Object Evaluator::applyLambda(const Reader::List* lambda, const Object* args, int count)
+{
+    if( lambda->list.size() < 2 )
+        return fail("illegal lambda expression");
+    if( depth >= MaxDepth )
+        return fail("stack overflow");
+    const int mark = bindings.size();
+    const Object& params = lambda->list[1];
+    if( params.type() == Object::List_ || params.type() == Object::Cons_ )
+    {
+        const int base = tp;
+        const Reader::List* p = elements(params);
+        for( int i = 0; p && i < p->list.size(); i++ )
+        {
+            if( p->list[i].type() == Object::Atom_ )
+                bind(p->list[i].getAtomId(), i < count ? args[i] : Object());
+        }
+        pop(base);
+    }else if( params.type() == Object::Atom_ && params.getAtomId() != nilAtom )
+    {
+        // nospread: NLAMBDA gets the list of its args, LAMBDA their number
+        if( lambda->list.first().getAtomId() == nlambdaAtom )
+        {
+            Object l;
+            for( int i = count - 1; i >= 0; i-- )
+                l = cons(args[i], l);
+            bind(params.getAtomId(), l);
+        }else
+            bind(params.getAtomId(), Object(qint64(count)));
+    }
+    heap.collectIfDue(); // a safe point; the args are bound or on temps
+    depth++;
+    const Object res = progn(lambda, 2);
+    depth--;
+    unbind(mark);
+    return res;
+}
+
+Object Evaluator::special(quint8 s, const Reader::List* l)
+{
+    const int n = l->list.size();
+    switch( s )
+    {
+    case Quote:
+    case Function:
+        return n > 1 ? data(l->list[1]) : Object();
+    case Lambda:
+        return data(Object(const_cast<Reader::List*>(l))); // like the GCONST of the Compiler
+    case Cond:
+        return cond(l);
+    case SetQ:
+    case SetQQ:
+        {
+            if( n < 2 || l->list[1].type() != Object::Atom_ )
+                return fail("SETQ needs an atom");
+            const Object v = n < 3 ? Object() : s == SetQ ? eval(l->list[2]) : data(l->list[2]);
+            if( jump != NoJump || !error.isEmpty() )
+                return Object();
+            atoms[l->list[1].getAtomId()].value = v; // the current binding
+            return v;
+        }
+    case Prog:
+        return prog(l);
+    case Progn:
+        return progn(l, 1);
+    case Go:
+        if( n < 2 || l->list[1].type() != Object::Atom_ )
+            return fail("GO needs a label");
+        label = l->list[1].getAtomId();
+        jump = GoJump;
+        return Object();
+    case Return:
+        {
+            const Object v = n > 1 ? eval(l->list[1]) : Object();
+            if( jump != NoJump || !error.isEmpty() )
+                return Object();
+            result = v;
+            jump = ReturnJump;
+            return Object();
+        }
+    case And:
+        // no Object holds a value across an evaluation, since it might be collected
+        for( int i = 1; i < n - 1; i++ )
+        {
+            const bool nil = isNil(eval(l->list[i]));
+            if( jump != NoJump || !error.isEmpty() || nil )
+                return Object();
+        }
+        return n > 1 ? eval(l->list[n-1]) : t;
+    case Or:
+        for( int i = 1; i < n; i++ )
+        {
+            const Object res = eval(l->list[i]);
+            if( jump != NoJump || !error.isEmpty() )
+                return Object();
+            if( !isNil(res) )
+                return res;
+        }
+        return Object();
+    case SelectQ:
+        return selectq(l);
+    case Let:
+        return let(l, false);
+    case LetStar:
+        return let(l, true);
+    }
+    return Object();
+}
+
+Object Evaluator::progn(const Reader::List* l, int from)
+{
+    // only the value of the last form is kept, so no Object refers to a collected list
+    const int n = l->list.size();
+    for( int i = from; i < n - 1; i++ )
+    {
+        eval(l->list[i]);
+        if( jump != NoJump || !error.isEmpty() )
+            return Object();
+    }
+    return from < n ? eval(l->list[n-1]) : Object();
+}
+
+Object Evaluator::prog(const Reader::List* l)
+{
+    const int mark = bindings.size();
+    const int base = tp;
+    const Reader::List* vars = l->list.size() > 1 ? elements(l->list[1]) : 0;
+    for( int i = 0; vars && i < vars->list.size(); i++ )
+    {
+        const Object& v = vars->list[i];
+        if( v.type() == Object::Atom_ )
+        {
+            bind(v.getAtomId(), Object());
+            continue;
+        }
+        const int top = tp;
+        const Reader::List* b = elements(v);
+        if( b && !b->list.isEmpty() )
+        {
+            const Object init = b->list.size() > 1 ? eval(b->list[1]) : Object();
+            if( jump != NoJump || !error.isEmpty() )
+            {
+                pop(base);
+                unbind(mark);
+                return Object();
+            }
+            bind(b->list.first().getAtomId(), init);
+        }
+        pop(top);
+    }
+    pop(base);
+    Object res;
+    int pc = 2;
+    while( pc < l->list.size() && error.isEmpty() )
+    {
+        const Object& s = l->list[pc++];
+        if( s.type() == Object::Atom_ )
+            continue; // a label
+        eval(s);
+        if( jump == ReturnJump )
+        {
+            res = result;
+            result = Object();
+            jump = NoJump;
+            break;
+        }else if( jump == GoJump )
+        {
+            int to = -1;
+            for( int i = 2; i < l->list.size(); i++ )
+            {
+                if( l->list[i].type() == Object::Atom_ && l->list[i].getAtomId() == label )
+                {
+                    to = i + 1;
+                    break;
+                }
+            }
+            if( to < 0 )
+                break; // the label belongs to an enclosing PROG
+            if( to < pc )
+                heap.collectIfDue(); // a safe point in loops
+            pc = to;
+            jump = NoJump;
+        }
+    }
+    unbind(mark);
+    return res;
+}
+
+Object Evaluator::cond(const Reader::List* l)
+{
+    for( int i = 1; i < l->list.size(); i++ )
+    {
+        const int base = tp;
+        const Reader::List* c = elements(l->list[i]);
+        if( c == 0 || c->list.isEmpty() )
+        {
+            pop(base);
+            continue;
+        }
+        if( c->list.size() == 1 )
+        {
+            const Object test = eval(c->list.first());
+            pop(base);
+            if( jump != NoJump || !error.isEmpty() )
+                return Object();
+            if( !isNil(test) )
+                return test;
+            continue;
+        }
+        const bool nil = isNil(eval(c->list.first())); // the test value is not held across progn
+        if( jump != NoJump || !error.isEmpty() )
+        {
+            pop(base);
+            return Object();
+        }
+        if( !nil )
+        {
+            const Object res = progn(c, 1);
+            pop(base);
+            return res;
+        }
+        pop(base);
+    }
+    return Object();
+}
+
+Object Evaluator::selectq(const Reader::List* l)
+{
+    // (SELECTQ x (key forms...) ((key key...) forms...) ... default)
+    const int n = l->list.size();
+    if( n < 2 )
+        return Object();
+    const int base = tp;
+    const Reader::List* clause = 0;
+    {
+        // v goes out of scope before the forms of the clause are evaluated
+        const Object v = eval(l->list[1]);
+        if( jump != NoJump || !error.isEmpty() )
+            return Object();
+        for( int i = 2; i < n - 1 && clause == 0; i++ )
+        {
+            const int top = tp;
+            const Reader::List* c = elements(l->list[i]);
+            if( c == 0 || c->list.isEmpty() )
+            {
+                pop(top);
+                continue;
+            }
+            const Object& key = c->list.first();
+            bool hit = false;
+            const Reader::List* keys = elements(key);
+            if( keys )
+            {
+                for( int j = 0; j < keys->list.size() && !hit; j++ )
+                    hit = keys->list[j].isSame(v);
+            }else
+                hit = key.isSame(v) || ( isNil(key) && isNil(v) );
+            if( hit )
+                clause = c; // stays on temps
+            else
+                pop(top);
+        }
+    }
+    const Object res = clause ? progn(clause, 1) : n > 2 ? eval(l->list[n-1]) : Object();
+    pop(base);
+    return res;
+}
+
+Object Evaluator::let(const Reader::List* l, bool sequential)
+{
+    const int mark = bindings.size();
+    const int base = tp;
+    const Reader::List* vars = l->list.size() > 1 ? elements(l->list[1]) : 0;
+    if( vars )
+    {
+        // LET evaluates all inits before binding, LET* binds each before the next init;
+        // the values of LET wait on temps
+        const int values = tp;
+        if( !sequential && !reserve(vars->list.size()) )
+        {
+            pop(base);
+            return Object();
+        }
+        QVarLengthArray<quint32,8> ids;
+        for( int i = 0; i < vars->list.size(); i++ )
+        {
+            const Object& v = vars->list[i];
+            quint32 id = 0;
+            Object init;
+            if( v.type() == Object::Atom_ )
+                id = v.getAtomId();
+            else
+            {
+                const int top = tp;
+                const Reader::List* b = elements(v);
+                if( b && !b->list.isEmpty() )
+                {
+                    id = b->list.first().getAtomId();
+                    if( b->list.size() > 1 )
+                        init = eval(b->list[1]);
+                }
+                pop(top);
+                if( jump != NoJump || !error.isEmpty() )
+                {
+                    pop(base);
+                    unbind(mark);
+                    return Object();
+                }
+            }
+            if( id == 0 )
+                continue;
+            if( sequential )
+                bind(id, init);
+            else
+            {
+                temps[values + ids.size()] = init;
+                ids.append(id);
+            }
+        }
+        for( int i = 0; i < ids.size(); i++ )
+            bind(ids[i], temps[values + i]);
+    }
+    pop(base);
+    const Object res = progn(l, 2);
+    unbind(mark);
+    return res;
+}
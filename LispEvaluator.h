@@ -0,0 +1,148 @@
+#ifndef LISPEVALUATOR_H
+#define LISPEVALUATOR_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include <QVector>
+#include <QHash>
+#include "LispHeap.h"
+
+namespace Lisp
+{
+
+// Runs DEFINEQ functions directly from the objects of the Reader. Variables are shallow bound: the
+// value cell of an atom holds the current value, and the bind stack the values it shadows until the
+// binding LAMBDA, PROG or LET returns. Special forms and primitives are found by atom id in dispatch
+// tables. The vectors of the Reader are only used for the source; the lists created at runtime are
+// cons cells of a Heap, so CDR and CONS share structure. A source list used as data, e.g. by QUOTE,
+// is converted to cells once, so the same constant always has the same identity. Cells evaluated
+// as code, e.g. by EVAL, are walked by a temporary vector of their elements. Errors are reported
+// like the Reader does it, i.e. by a message and a nil result; this includes the evaluation of an
+// atom which has no value, i.e. whose value cell holds NOBIND.
+// The values the C stack of the Evaluator holds across evaluations, i.e. evaluated args, LET inits
+// and the element vectors of evaluated cells, are kept on a shadow stack which is traced with the
+// value cells, so the Evaluator collects in run(), on entry of a LAMBDA once its args are bound,
+// and at backward GOs of a PROG.
+class Evaluator : public Heap::Roots
+{
+public:
+    typedef Reader::Object Object;
+    typedef Object (*Primitive)(Evaluator*, const Object* args, int count); // args are evaluated
+
+    Evaluator();
+
+    void load(const Object& ast); // defines the DEFINEQ functions and sets the RPAQ and RPAQQ variables
+    void define(quint32 atom, const Object& lambda);
+    void addPrimitive(const char* name, Primitive);
+    Object getValue(quint32 atom) const; // nil if unbound
+    bool isBound(quint32 atom) const
+    {
+        return atom < quint32(atoms.size()) && !atoms[atom].value.isSame(unbound);
+    }
+    void setValue(quint32 atom, const Object&);
+    const Object& getDefinition(quint32 atom) const;
+    Object getProperty(quint32 atom, quint32 prop) const;
+    void setProperty(quint32 atom, quint32 prop, const Object&);
+
+    Object run(const Object& form); // evaluates form from the top level; may collect garbage before
+    Object eval(const Object& form); // for primitives which evaluate
+    Object apply(const Object& fn, const Object* args, int count);
+    Object apply(const Object& fn, const Object& args); // spreads the elements of a list of cells as args
+
+    Object fail(const QString& msg); // records the first error and returns nil
+    bool hasError() const { return !error.isEmpty(); }
+    const QString& getError() const { return error; }
+    void clearError() { error.clear(); }
+
+    bool isNil(const Object& o) const
+    {
+        return o.type() == Object::Nil_ || ( o.type() == Object::List_ && o.getList()->list.isEmpty() ) ||
+                o.getAtomId() == nilAtom;
+    }
+    Object boolean(bool b) const { return b ? t : Object(); }
+    Object cons(const Object& car, const Object& cdr) { return Object(heap.newCons(car, cdr)); }
+    Object data(const Object&); // a list of the Reader as cells, other objects as they are
+    Heap* getHeap() { return &heap; }
+    void markRoots(Heap*);
+private:
+    enum Special { NoSpecial, Quote, Function, Cond, SetQ, SetQQ, Prog, Progn, Go, Return, And, Or,
+                   SelectQ, Let, LetStar, Lambda };
+    enum Jump { NoJump, GoJump, ReturnJump };
+    struct Binding
+    {
+        quint32 atom;
+        Object old;
+        Binding(quint32 a = 0, const Object& o = Object()):atom(a),old(o){}
+    };
+    struct Quoted
+    {
+        Object source; // keeps the list of the Reader, so its address is not reused
+        Object data;
+        Quoted(const Object& s = Object(), const Object& d = Object()):source(s),data(d){}
+    };
+    void ensure();
+    void bind(quint32 atom, const Object& value)
+    {
+        bindings.append(Binding(atom, atoms[atom].value));
+        atoms[atom].value = value;
+    }
+    void unbind(int mark);
+    bool reserve(int n); // n nil slots on temps, or fails
+    void pop(int base)
+    {
+        while( tp > base )
+            temps[--tp] = Object();
+    }
+    Object cells(const Reader::List*);
+    const Reader::List* elements(const Object&); // 0 if no list; the vector of cells stays on temps
+    Object evalList(const Reader::List*);
+    Object call(const Reader::List* lambda, const Reader::List* form);
+    Object applyLambda(const Reader::List* lambda, const Object* args, int count);
+    Object special(quint8, const Reader::List*);
+    Object progn(const Reader::List*, int from);
+    Object prog(const Reader::List*);
+    Object cond(const Reader::List*);
+    Object selectq(const Reader::List*);
+    Object let(const Reader::List*, bool sequential);
+
+    Heap heap; // declared first, so it is deleted after all objects referring to its lists
+    QVector<Reader::Atom> atoms; // atom id -> value cell and properties
+    QVector<Object> functions; // atom id -> definition cell
+    QVector<Primitive> primitives; // atom id -> primitive or null
+    QVector<quint8> specials; // atom id -> Special
+    QVector<Binding> bindings;
+    QHash<const Reader::List*,Quoted> quoted; // source list -> its cells
+    QVector<Object> temps; // the shadow stack; fixed size, so pointers to its slots stay valid
+    int tp; // the top of temps; the slots above are nil
+    Object t;
+    Object unbound; // the value of atoms which were never set or bound
+    quint32 nilAtom, lambdaAtom, nlambdaAtom, defineq, rpaq, rpaqq;
+    quint8 jump;
+    quint32 label; // of GO
+    Object result; // of RETURN
+    int depth;
+    QString error;
+};
+
+}
+
+#endif // LISPEVALUATOR_H
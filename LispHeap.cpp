@@ -0,0 +1,160 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include "LispHeap.h"
+#include "LispTrace.h"
+using namespace Lisp;
+
+Heap::Heap():threshold(100000),tenuredAfterFull(0),full(false),minor(0),major(0),freed(0)
+{
+}
+
+Heap::~Heap()
+{
+    QVector<Reader::Cons*> all = young + old;
+    destroy(all);
+}
+
+Reader::Cons* Heap::newCons(const Object& car, const Object& cdr)
+{
+    Reader::Cons* c = new Reader::Cons(car, cdr);
+    young.append(c);
+    return c;
+}
+
+void Heap::write(Reader::Cons* c)
+{
+    if( c->flags & Reader::Cons::Tenured )
+        remembered.insert(c);
+}
+
+void Heap::mark(const Object& o)
+{
+    if( o.type() != Object::Cons_ )
+        return;
+    Reader::Cons* c = o.getCons();
+    if( c->flags & Reader::Cons::Marked )
+        return;
+    if( !full && ( c->flags & Reader::Cons::Tenured ) )
+        return; // a minor collection takes the tenured cells as alive
+    c->flags |= Reader::Cons::Marked;
+    gray.append(c);
+}
+
+void Heap::addRoots(Heap::Roots* r)
+{
+    if( !rootSets.contains(r) )
+        rootSets.append(r);
+}
+
+void Heap::removeRoots(Heap::Roots* r)
+{
+    rootSets.removeAll(r);
+}
+
+void Heap::addRoot(Object* o)
+{
+    roots.append(o);
+}
+
+void Heap::removeRoot(Object* o)
+{
+    roots.removeOne(o);
+}
+
+void Heap::collect(bool f)
+{
+    Trace::Span span(f ? "full gc" : "minor gc");
+    full = f;
+    foreach( Roots* r, rootSets )
+        r->markRoots(this);
+    foreach( Object* o, roots )
+        mark(*o);
+    if( !full )
+    {
+        // the only tenured cells which can refer to young ones
+        foreach( Reader::Cons* c, remembered )
+        {
+            mark(c->car);
+            mark(c->cdr);
+        }
+    }
+    while( !gray.isEmpty() )
+    {
+        Reader::Cons* c = gray.last();
+        gray.pop_back();
+        mark(c->car);
+        mark(c->cdr);
+    }
+    QVector<Reader::Cons*> dead;
+    if( full )
+        sweep(old, false, dead);
+    sweep(young, true, dead);
+    destroy(dead);
+    remembered.clear();
+    if( full )
+    {
+        major++;
+        tenuredAfterFull = old.size();
+    }else
+        minor++;
+    full = false;
+}
+
+void Heap::collectIfDue()
+{
+    if( isDue() )
+        collect(old.size() > 2 * qMax(tenuredAfterFull, threshold));
+}
+
+void Heap::sweep(QVector<Reader::Cons*>& cells, bool tenure, QVector<Reader::Cons*>& dead)
+{
+    int j = 0;
+    for( int i = 0; i < cells.size(); i++ )
+    {
+        Reader::Cons* c = cells[i];
+        if( c->flags & Reader::Cons::Marked )
+        {
+            c->flags = Reader::Cons::Tenured;
+            if( tenure )
+                old.append(c);
+            else
+                cells[j++] = c;
+        }else
+            dead.append(c);
+    }
+    cells.resize(tenure ? 0 : j);
+}
+
+void Heap::destroy(QVector<Reader::Cons*>& dead)
+{
+    // car and cdr of all dead cells are dropped before the first cell is deleted, so no element
+    // released refers to a cell which is already gone
+    for( int i = 0; i < dead.size(); i++ )
+    {
+        dead[i]->car = Object();
+        dead[i]->cdr = Object();
+    }
+    for( int i = 0; i < dead.size(); i++ )
+        delete dead[i];
+    freed += dead.size();
+    dead.clear();
+}
@@ -0,0 +1,91 @@
+#ifndef LISPHEAP_H
+#define LISPHEAP_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include <QSet>
+#include <QVector>
+#include "LispReader.h"
+
+namespace Lisp
+{
+
+// A generational mark and sweep collector for the cons cells the Evaluator and the Machine create
+// at runtime. Cells are not reference counted; copying an Object of a cell costs nothing, CDR and
+// CONS share structure, and structures mutated by RPLACA, RPLACD or NCONC may form cycles. New
+// cells are young; a minor collection traces the young cells reachable from the roots and from
+// the remembered tenured cells and tenures the survivors, a full collection traces all. The lists
+// of the Reader stay reference counted and hold no cells, so they are not traced.
+// Collections only happen when called, so the owner of the roots has to be at a safe point, i.e.
+// no cell may be held by an Object outside the roots, since it might be freed.
+class Heap
+{
+public:
+    typedef Reader::Object Object;
+    class Roots
+    {
+    public:
+        virtual ~Roots() {}
+        virtual void markRoots(Heap*) = 0; // calls mark for each object it holds
+    };
+
+    Heap();
+    ~Heap(); // frees all cells, so Objects still referring to them must be gone before
+
+    Reader::Cons* newCons(const Object& car = Object(), const Object& cdr = Object());
+    void write(Reader::Cons*); // barrier; call whenever the car or cdr of an existing cell is replaced
+    void mark(const Object&);
+
+    void addRoots(Roots*);
+    void removeRoots(Roots*);
+    void addRoot(Object*); // an explicit root, e.g. a variable holding a result across collections
+    void removeRoot(Object*);
+
+    bool isDue() const { return young.size() >= threshold; }
+    void collect(bool full = false);
+    void collectIfDue(); // a full collection when the tenured cells have doubled since the last one
+    void setThreshold(int n) { threshold = n; } // of young cells which triggers a collection
+
+    int getYoung() const { return young.size(); }
+    int getTenured() const { return old.size(); }
+    int getMinorCount() const { return minor; }
+    int getFullCount() const { return major; }
+    qint64 getFreed() const { return freed; }
+private:
+    void sweep(QVector<Reader::Cons*>&, bool tenure, QVector<Reader::Cons*>& dead);
+    void destroy(QVector<Reader::Cons*>& dead);
+
+    QVector<Reader::Cons*> young, old;
+    QVector<Reader::Cons*> gray; // marked, but car and cdr not yet traced
+    QSet<Reader::Cons*> remembered; // tenured cells which were written since the last collection
+    QList<Roots*> rootSets;
+    QList<Object*> roots;
+    int threshold;
+    int tenuredAfterFull;
+    bool full; // of the running collection
+    int minor, major;
+    qint64 freed;
+};
+
+}
+
+#endif // LISPHEAP_H
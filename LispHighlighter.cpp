@@ -21,8 +21,10 @@
 
 #include "LispHighlighter.h"
 #include "LispLexer.h"
-#include <QBuffer>
+#include "LispBuiltins.h"
+#include "LispTrace.h"
 #include <QTextDocument>
+#include <QTimerEvent>
 #include <QtDebug>
 using namespace Lisp;
 
@@ -30,9 +32,12 @@ static const char* QUOTE;
 
 
 Highlighter::Highlighter(QTextDocument* parent) :
-    QSyntaxHighlighter(parent)
+    QSyntaxHighlighter(parent),watermark(0)
 {
     QUOTE = Token::getSymbol("QUOTE").constData();
+    lex.setEmitComments(true);
+    lex.setPacked(false);
+    line.reserve(256); // keeps resize() from reallocating when the lines get shorter
 
     const int pointSize = parent->defaultFont().pointSize();
     for( int i = 0; i < C_Max; i++ )
@@ -60,32 +65,97 @@ Highlighter::Highlighter(QTextDocument* parent) :
     d_format[C_Pp].setBackground(QColor(230, 255, 230));
 
     //d_builtins = createBuiltins();
-    d_syntax.insert(Token::getSymbol("NIL").constData());
-    d_syntax.insert(Token::getSymbol("T").constData());
-    d_syntax.insert(Token::getSymbol("LAMBDA").constData());
-    d_syntax.insert(Token::getSymbol("NLAMBDA").constData());
+    initSymbols();
 }
 
-void Highlighter::addFunction(const char* bi)
+void Highlighter::initSymbols()
 {
-    d_functions << bi;
+    // the classification is stored with the interned atoms, so this has only to be done once
+    static bool done = false;
+    if( done )
+        return;
+    done = true;
+    for(int i = 0; Builtins::functions[i]; i++)
+    {
+        const char* sym = Token::getSymbol(Builtins::functions[i]).constData();
+        Token::setSymbolFlags(sym, Token::getSymbolFlags(sym) | Token::BuiltinFunction);
+    }
+    for(int i = 0; Builtins::variables[i]; i++)
+    {
+        const char* sym = Token::getSymbol(Builtins::variables[i]).constData();
+        Token::setSymbolFlags(sym, Token::getSymbolFlags(sym) | Token::BuiltinVariable);
+    }
+    const char* syntax[] = { "NIL", "T", "LAMBDA", "NLAMBDA", 0 };
+    for(int i = 0; syntax[i]; i++)
+    {
+        const char* sym = Token::getSymbol(syntax[i]).constData();
+        Token::setSymbolFlags(sym, Token::getSymbolFlags(sym) | Token::SyntaxSym);
+    }
 }
 
-void Highlighter::addVariable(const char* bi)
+QTextCharFormat Highlighter::formatForCategory(int c) const
 {
-    d_variables << bi;
+    return d_format[c];
 }
 
-QTextCharFormat Highlighter::formatForCategory(int c) const
+void Highlighter::highlightUpTo(int blockCount)
 {
-    return d_format[c];
+    QTextDocument* doc = document();
+    if( doc == 0 )
+        return;
+    blockCount = qMin(blockCount, doc->blockCount());
+    if( blockCount > watermark )
+    {
+        Trace::Span span("highlight");
+        const int from = watermark;
+        watermark = blockCount;
+        // continues as long as the block states change, i.e. up to the first block above the watermark
+        rehighlightBlock(doc->findBlockByNumber(from));
+    }
+    if( watermark < doc->blockCount() && !idle.isActive() )
+        idle.start(0, this);
 }
 
-void Highlighter::clearFromHere(quint32 line)
+void Highlighter::reset()
 {
-    LineState::iterator i = lineState.upperBound(line);
-    while( i != lineState.end() )
-        i = lineState.erase(i);
+    watermark = 0;
+    idle.stop();
+}
+
+void Highlighter::timerEvent(QTimerEvent* e)
+{
+    if( e->timerId() != idle.timerId() )
+    {
+        QSyntaxHighlighter::timerEvent(e);
+        return;
+    }
+    QTextDocument* doc = document();
+    if( doc == 0 || watermark >= doc->blockCount() )
+    {
+        idle.stop();
+        return;
+    }
+    highlightUpTo(watermark + 500);
+}
+
+void Highlighter::setBlockState(int state, const QByteArray& brackets)
+{
+    BlockData* data = static_cast<BlockData*>(currentBlockUserData());
+    if( data == 0 )
+    {
+        data = new BlockData();
+        setCurrentBlockUserData(data);
+    }
+    // QSyntaxHighlighter only continues with the next block if the state changed; the bracket
+    // stack doesn't fit in the state, so a change of the stack is signalled by toggling bit 24
+    if( data->brackets != brackets )
+    {
+        data->brackets = brackets;
+        data->toggle = !data->toggle;
+    }
+    if( data->toggle )
+        state |= 1 << 24;
+    setCurrentBlockState(state);
 }
 
 #if 0
@@ -127,6 +197,13 @@ static bool punctuation(const QString& str, int pos, int len)
 
 void Highlighter::highlightBlock(const QString& text)
 {
+    if( currentBlock().blockNumber() >= watermark )
+    {
+        // not yet; the state stays -1 so that a rehighlightBlock stops here
+        setCurrentBlockState(-1);
+        return;
+    }
+
     const int previousBlockState_ = previousBlockState();
     quint8 lexerState = 0,
             braceDepth = 0,  // nesting level of [] or ()
@@ -137,8 +214,10 @@ void Highlighter::highlightBlock(const QString& text)
         commentLevel = (previousBlockState_ >> 16) & 0xff;
     }
 
-    const quint32 line = currentBlock().blockNumber() + 1;
-    clearFromHere(line);
+    QByteArray brackets;
+    const QTextBlock prev = currentBlock().previous();
+    if( prev.isValid() && prev.userData() )
+        brackets = static_cast<BlockData*>(prev.userData())->brackets;
 
     // we can be in a (, [, (*, " or QUOTE
     // [ requires memorizing the previous open occurences
@@ -151,23 +230,35 @@ void Highlighter::highlightBlock(const QString& text)
     bool inString = lexerState & 1;
     bool inQuote = lexerState & 2;
 
-    Lexer lex;
-    lex.setEmitComments(true);
-    lex.setPacked(false);
-    lex.setStream(text.toLatin1(), "");
+    const int len = text.size();
+    line.resize(len);
+    const QChar* src = text.constData();
+    char* dst = line.data();
+    for( int i = 0; i < len; i++ )
+    {
+        const ushort ch = src[i].unicode();
+        dst[i] = ch < 256 ? char(ch) : '?'; // like QString::toLatin1, e.g. for the ← and ↑ of decode()
+    }
+    lex.setStream(line.constData(), len, QString());
 
     Token t;
     if( inString )
     {
         t = lex.readString();
         setFormat( 0, t.len, formatForCategory(C_Str) );
-        if( t.val.endsWith('"') && ((t.pos.col + t.len) < 2 || text[t.pos.col + t.len - 2] != '%') ) // ": -1, %: -2
+        // t.pos + t.len - 1 is the last char read; the string is closed there unless this quote
+        // was escaped by an odd number of preceding %
+        const int last = t.pos + t.len - 1;
+        int escapes = 0;
+        while( last - 1 - escapes >= 0 && last - 1 - escapes < len && text[last - 1 - escapes] == '%' )
+            escapes++;
+        if( t.val.endsWith('"') && escapes % 2 == 0 )
             inString = false;
         else
         {
             // the whole line is in the string
             // lexer state remains the same
-            setCurrentBlockState(previousBlockState_);
+            setBlockState(previousBlockState_ & 0xffffff, brackets);
             return;
         }
     }
@@ -196,7 +287,7 @@ void Highlighter::highlightBlock(const QString& text)
             braceDepth--;
             break;
         case Tok_lbrack:
-            lineState[line] = braceDepth;
+            brackets.append(char(braceDepth));
             braceDepth++;
             if( commentLevel )
                 f = formatForCategory(C_Cmt);
@@ -208,31 +299,32 @@ void Highlighter::highlightBlock(const QString& text)
                 f = formatForCategory(C_Cmt);
             else
                 f = formatForCategory(C_Op2);
-            if( !lineState.isEmpty() )
+            if( !brackets.isEmpty() )
             {
-                const quint32 lastLine = lineState.lastKey();
-                braceDepth = lineState.value(lastLine);
-                lineState.remove(lastLine);
+                braceDepth = quint8(brackets[brackets.size()-1]);
+                brackets.chop(1);
                 if( braceDepth <= commentLevel )
                     commentLevel = 0;
             }
             break;
-        case Tok_atom:
+        case Tok_atom: {
+            const quint8 flags = t.val.isEmpty() ? 0 : Token::getSymbolFlags(t.val.constData());
             if( commentLevel )
                 f = formatForCategory(C_Cmt);
-            else if( d_syntax.contains(t.val.constData()) )
+            else if( flags & Token::SyntaxSym )
                 f = formatForCategory(C_Op1);
-            else if( d_functions.contains(t.val.constData()) )
+            else if( flags & Token::BuiltinFunction )
                 f = formatForCategory(C_Func);
-            else if( d_variables.contains(t.val.constData() ) )
+            else if( flags & Token::BuiltinVariable )
                 f = formatForCategory(C_Var);
-            //else if( punctuation(text, t.pos.col-1, t.len ) )
+            //else if( punctuation(text, t.pos, t.len ) )
             //    f = formatForCategory(C_Op3);
             else
                 f = formatForCategory(C_Ident);
             if( !inString && commentLevel == 0 && t.val.constData() == QUOTE )
                 inQuote = true;
             break;
+        }
         case Tok_float:
         case Tok_integer:
             if( commentLevel )
@@ -261,7 +353,7 @@ void Highlighter::highlightBlock(const QString& text)
             break;
         }
         if( f.isValid() )
-            setFormat( t.pos.col-1, t.len, f );
+            setFormat( t.pos, t.len, f );
         t = lex.nextToken();
     }
 
@@ -270,7 +362,7 @@ void Highlighter::highlightBlock(const QString& text)
         lexerState |= 1;
     if( inQuote )
         lexerState |= 2;
-    setCurrentBlockState((commentLevel << 16) | (braceDepth << 8) | lexerState );
+    setBlockState((commentLevel << 16) | (braceDepth << 8) | lexerState, brackets );
 }
 
 
@@ -23,8 +23,9 @@
 // derived from Luon Highlighter
 
 #include <QSyntaxHighlighter>
-#include <QSet>
-#include <QMap>
+#include <QTextBlockUserData>
+#include <QBasicTimer>
+#include "LispLexer.h"
 
 namespace Lisp
 {
@@ -33,22 +34,34 @@ namespace Lisp
     public:
         enum { TokenProp = QTextFormat::UserProperty };
         explicit Highlighter(QTextDocument *parent = 0);
-        void addFunction(const char* bi);
-        void addVariable(const char* bi);
+        static void initSymbols();
+        // Blocks are only highlighted up to a watermark, which is raised by the viewer for the
+        // visible blocks and in chunks when the application is idle.
+        void highlightUpTo(int blockCount);
+        void reset(); // to be called before the text of the document is replaced
 
     protected:
         QTextCharFormat formatForCategory(int) const;
-        void clearFromHere(quint32 line);
+        void setBlockState(int state, const QByteArray& brackets);
 
         // overrides
         void highlightBlock(const QString &text);
+        void timerEvent(QTimerEvent*);
 
     private:
         enum Category { C_Num, C_Str, C_Func, C_Var, C_Ident, C_Op1, C_Op2, C_Op3, C_Pp, C_Cmt, C_Max };
         QTextCharFormat d_format[C_Max];
-        QSet<const char*> d_functions, d_variables, d_syntax;
-        typedef QMap<quint32,quint16> LineState;
-        LineState lineState; // line -> level
+        class BlockData : public QTextBlockUserData
+        {
+        public:
+            QByteArray brackets; // braceDepth of each '[' still open at the end of the block
+            bool toggle;
+            BlockData():toggle(false){}
+        };
+        Lexer lex; // reused for all blocks
+        QByteArray line; // Latin-1 copy of the current block, capacity is reused
+        QBasicTimer idle;
+        int watermark; // the blocks below are highlighted
     };
 }
 
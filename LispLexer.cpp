@@ -23,11 +23,21 @@
 #include <QBuffer>
 #include <QFile>
 #include <QHash>
+#include <QReadWriteLock>
+#include <QAtomicInt>
 #include <QFileInfo>
 #include <QtDebug>
+#include <stdlib.h>
+#include <string.h>
 using namespace Lisp;
 
-static QHash<QByteArray,QByteArray> s_symbols;
+// id -> record, in pages which are never moved
+enum { PageBits = 12, PageSize = 1 << PageBits, MaxPages = 1024 };
+static Symbol** s_pages[MaxPages];
+// published after the page slot of the new record is written, so readers need no lock for id < count
+static QAtomicInt s_count(0);
+static QHash<QByteArray,Symbol*> s_symbols; // the keys are raw data pointing to the pname of the record
+static QReadWriteLock s_lock; // interning is shared by the Readers parsing chunks in parallel
 
 bool Token::isValid() const
 {
@@ -73,52 +83,125 @@ const char*Token::getString() const
     return ""; // TODO tokenTypeString(d_type);
 }
 
+static Symbol* createSymbol(const QByteArray& str)
+{
+    const quint32 id = s_count.loadAcquire(); // the write lock is held
+    Q_ASSERT( id < MaxPages * PageSize );
+    Symbol* s = static_cast<Symbol*>(::malloc(sizeof(Symbol) + str.size()));
+    s->id = id;
+    s->len = str.size();
+    s->srcLen = str.size();
+    for( int i = 0; i < str.size(); i++ )
+    {
+        if( Lexer::atom_delimiter(str[i]) )
+            s->srcLen++; // escaped in source code
+    }
+    s->flags = Token::NoFlags;
+    ::memcpy(s->pname, str.constData(), str.size());
+    s->pname[str.size()] = 0;
+
+    Symbol**& page = s_pages[id >> PageBits];
+    if( page == 0 )
+        page = new Symbol*[PageSize];
+    page[id & (PageSize - 1)] = s;
+    s_count.storeRelease(id + 1);
+    s_symbols.insert(QByteArray::fromRawData(s->pname, s->len), s);
+    return s;
+}
+
 QByteArray Token::getSymbol(const QByteArray& str)
 {
-    if( str.isEmpty() )
-        return str;
-    QByteArray& sym = s_symbols[str];
-    if( sym.isEmpty() )
-        sym = str;
-    return sym;
+    {
+        // most atoms are already known, so usually only the shared lock is needed
+        QReadLocker lock(&s_lock);
+        const Symbol* s = s_symbols.value(str);
+        if( s != 0 )
+            return QByteArray::fromRawData(s->pname, s->len);
+    }
+    QWriteLocker lock(&s_lock);
+    if( s_count.loadAcquire() == 0 )
+        createSymbol(QByteArray()); // id 0
+    Symbol* s = s_symbols.value(str);
+    if( s == 0 )
+        s = createSymbol(str);
+    return QByteArray::fromRawData(s->pname, s->len);
 }
 
 QByteArrayList Token::getAllSymbols()
 {
-    QHash<QByteArray,QByteArray>::const_iterator i;
     QByteArrayList res;
-    for( i = s_symbols.begin(); i != s_symbols.end(); ++i )
-        res.append( i.key() );
+    const quint32 count = s_count.loadAcquire();
+    for( quint32 id = 1; id < count; id++ )
+    {
+        const Symbol* s = s_pages[id >> PageBits][id & (PageSize - 1)];
+        res.append( QByteArray::fromRawData(s->pname, s->len) );
+    }
     return res;
 }
 
+quint32 Token::getSymbolCount()
+{
+    return s_count.loadAcquire();
+}
+
+qint64 Token::getSymbolTableBytes()
+{
+    enum { MallocOverhead = 16 };
+    QReadLocker lock(&s_lock);
+    qint64 res = sizeof(s_pages);
+    const quint32 count = s_count.loadAcquire();
+    for( quint32 id = 0; id < count; id++ )
+    {
+        if( ( id & (PageSize - 1) ) == 0 )
+            res += PageSize * sizeof(Symbol*) + MallocOverhead;
+        res += sizeof(Symbol) + s_pages[id >> PageBits][id & (PageSize - 1)]->len + MallocOverhead;
+    }
+    res += s_symbols.capacity() * sizeof(void*) +
+            s_symbols.size() * ( sizeof(QHashNode<QByteArray,Symbol*>) + MallocOverhead );
+    return res;
+}
+
+const char* Token::getSymbolById(quint32 id)
+{
+    if( id >= quint32(s_count.loadAcquire()) )
+    {
+        // the empty atom 0 instead of a literal, so Symbol::get also works for the result
+        if( s_count.loadAcquire() == 0 )
+        {
+            QWriteLocker lock(&s_lock);
+            if( s_count.loadAcquire() == 0 )
+                createSymbol(QByteArray());
+        }
+        id = 0;
+    }
+    return s_pages[id >> PageBits][id & (PageSize - 1)]->pname;
+}
+
 char Lexer::readc()
 {
-    static char last = 0;
     char res;
-    if( in && !in->atEnd() && in->getChar(&res) )
+    if( getChar(res) )
     {
         if( res == '\r' )
         {
-            char c;
-            in->getChar(&c);
-            in->ungetChar(c);
+            char c = 0;
+            if( getChar(c) )
+                ungetChar(c);
             if( c == '\n' )
                 res = ' ';
             else
                 res = '\n'; // immediatedly convert to \n
         }else if( res == 0 || (!isprint(res) && !isspace(res)) )
         {
-            if( last == '%' )
-                return ' '; // TODO: we need another solution, maybe (CHARACTER res); TODO: sync with Navigator::decode
-            return readc(); // ignore all clutter
+            if( last != '%' )
+                return readc(); // ignore all clutter
+            // escaped clutter is read as a blank, which Project::decode also emits, so it counts
+            // TODO: we need another solution, maybe (CHARACTER res)
+            res = ' ';
         }
+        pos++;
         if( res == '\n' )
-        {
-            pos.row++;
-            pos.col = 1;
-        }else
-            pos.col++;
+            lines.addLine(pos);
         if( res == 0 )
             res = -1;
         Q_ASSERT(isspace(res) || isprint(res));
@@ -141,23 +224,65 @@ void Lexer::ungetc(char c)
         return;
     Q_ASSERT(isspace(c) || isprint(c));
 
-    if( in && c )
+    if( c == '\n' )
+        c = ' ';
+    if( pos != 0 )
+        pos--;
+    ungetChar(c);
+}
+
+bool Lexer::getChar(char& c)
+{
+    if( in )
+        return !in->atEnd() && in->getChar(&c);
+    if( !pushback.isEmpty() )
     {
-        if( c == '\n' )
-            c = ' ';
-        //Q_ASSERT( pos.col != 0 );
-        if( pos.col != 0 )
-            pos.col--;
-        in->ungetChar(c);
+        c = pushback[pushback.size()-1];
+        pushback.chop(1);
+        return true;
     }
+    if( data && dataPos < dataLen )
+    {
+        c = data[dataPos++];
+        return true;
+    }
+    return false;
+}
+
+void Lexer::ungetChar(char c)
+{
+    if( in )
+        in->ungetChar(c);
+    else if( pushback.isEmpty() && dataPos > 0 && data[dataPos-1] == c )
+        dataPos--;
+    else
+        pushback.append(c);
 }
 
-QByteArray Lexer::peek(int count)
+bool Lexer::atEnd() const
 {
     if( in )
-        return in->peek(count);
+        return in->atEnd();
     else
-        return QByteArray();
+        return pushback.isEmpty() && ( data == 0 || dataPos >= dataLen );
+}
+
+char Lexer::peekc(int i)
+{
+    if( in )
+    {
+        char buf[4];
+        Q_ASSERT( i < 4 );
+        if( in->peek(buf, i + 1) <= i )
+            return 0;
+        return buf[i];
+    }
+    if( i < pushback.size() )
+        return pushback[pushback.size() - 1 - i];
+    i = dataPos + i - pushback.size();
+    if( data && i < dataLen )
+        return data[i];
+    return 0;
 }
 
 void Lexer::ungetstr(const QByteArray& str)
@@ -166,9 +291,10 @@ void Lexer::ungetstr(const QByteArray& str)
         ungetc(str[i]);
 }
 
-Lexer::Lexer(QObject* parent):QObject(parent),in(0),emitComments(false),packed(true),inQuote(false)
+Lexer::Lexer(QObject* parent):QObject(parent),in(0),data(0),dataLen(0),dataPos(0),last(0),pos(0),start(0),
+    emitComments(false),packed(true),inQuote(false)
 {
-
+    scratch.reserve(64);
 }
 
 void Lexer::setStream(QIODevice* in, const QString& sourcePath)
@@ -178,12 +304,35 @@ void Lexer::setStream(QIODevice* in, const QString& sourcePath)
     else
     {
         this->in = in;
-        pos.row = 1;
-        pos.col = 1;
+        data = 0;
+        dataLen = dataPos = 0;
+        pushback.resize(0);
+        buffer.clear();
+        last = 0;
+        pos = 0;
+        start = 0;
+        lines.clear();
         this->sourcePath = sourcePath;
     }
 }
 
+void Lexer::setStream(const char* data, int len, const QString& sourcePath, quint32 start)
+{
+    if( in && in->parent() == this )
+        in->deleteLater();
+    in = 0;
+    this->data = data;
+    dataLen = len;
+    dataPos = 0;
+    pushback.resize(0);
+    buffer.clear();
+    last = 0;
+    pos = start;
+    this->start = start;
+    lines.clear();
+    this->sourcePath = sourcePath;
+}
+
 void Lexer::setStream(const QByteArray& code, const QString& sourcePath)
 {
     QBuffer* buf = new QBuffer(this);
@@ -265,11 +414,12 @@ Token Lexer::nextTokenImp()
         return number();
     }else if(  c == '+' || c == '-' || c == '.' )
     {
-        const QByteArray la = peek(2);
+        const char la0 = peekc(0);
+        const char la1 = la0 ? peekc(1) : 0;
         ungetc(c);
-        if( !la.isEmpty() && isdigit(la[0]) )
+        if( isdigit(la0) )
             return number();
-        else if( (c == '+' || c == '-') && la.size() == 2 && la[0] == '.' && isdigit(la[1]) )
+        else if( (c == '+' || c == '-') && la0 == '.' && isdigit(la1) )
             return number(); // +/-.
         else
             return atom();
@@ -282,8 +432,7 @@ Token Lexer::nextTokenImp()
         return string();
     }else if( c == '(' || c == '[' || c == ')' || c == ']' )
     {
-        const QByteArray la = peek(1);
-        if( c == '(' && !la.isEmpty() && la[0] == '*' )
+        if( c == '(' && peekc() == '*' )
         {
             if( !packed )
             {
@@ -488,7 +637,9 @@ Token Lexer::number()
 
 Token Lexer::atom()
 {
-    QByteArray a;
+    QByteArray& a = scratch;
+    a.reserve(64); // only reallocates if a was handed out before
+    a.resize(0);
     int extra = 0;
     while( true )
     {
@@ -505,8 +656,8 @@ Token Lexer::atom()
         }
         a += c;
     }
-    a = Token::getSymbol(a);
-    return token(Tok_atom, a.size() + extra, a);
+    const QByteArray sym = Token::getSymbol(a);
+    return token(Tok_atom, sym.size() + extra, sym);
 }
 
 Token Lexer::string()
@@ -23,6 +23,7 @@
 // Adopted from the Luon project
 
 #include <QObject>
+#include <cstddef>
 #include "LispRowCol.h"
 
 class QIODevice;
@@ -46,6 +47,19 @@ enum TokenType {
     Tok_DblQuote, // "
 };
 
+// The record of an interned atom. The pname handed out by Token::getSymbol points into it,
+// so the attributes of an atom are at a constant offset from its pname.
+struct Symbol
+{
+    quint32 id; // dense, 0 is the empty atom
+    quint32 len; // of the pname
+    quint32 srcLen; // in source code, i.e. with the % escapes
+    quint8 flags; // Token::SymbolFlag
+    char pname[1]; // zero terminated, allocated with the record
+
+    static Symbol* get(const char* pname) { return reinterpret_cast<Symbol*>(const_cast<char*>(pname) - offsetof(Symbol,pname)); }
+};
+
 struct Token
 {
 #ifdef _DEBUG
@@ -59,22 +73,37 @@ struct Token
 #endif
     quint16 len;
 
-    RowCol pos;
+    quint32 pos; // offset, see LispRowCol.h
 
     QByteArray val;
     QString sourcePath;
-    Token(quint16 t = Tok_Invalid, const RowCol& rc = RowCol(), quint16 len = 0, const QByteArray& val = QByteArray() ):
-        type(t),pos(rc),len(len),val(val){}
+    Token(quint16 t = Tok_Invalid, quint32 pos = 0, quint16 len = 0, const QByteArray& val = QByteArray() ):
+        type(t),pos(pos),len(len),val(val){}
     bool isValid() const;
     bool isEof() const;
     const char* getName() const;
     const char* getString() const;
 
+    enum SymbolFlag { NoFlags = 0, SyntaxSym = 1, BuiltinFunction = 2, BuiltinVariable = 4 };
     static QByteArray getSymbol( const QByteArray& );
     static QByteArrayList getAllSymbols();
+    static quint32 getSymbolCount(); // all ids are below
+    static const char* getSymbolById( quint32 id );
+    static qint64 getSymbolTableBytes(); // approximate heap use of the records and the intern hash
+    // sym must be the constData() of a getSymbol() result
+    static quint32 getSymbolId( const char* sym ) { return Symbol::get(sym)->id; }
+    static quint8 getSymbolFlags( const char* sym ) { return Symbol::get(sym)->flags; }
+    static void setSymbolFlags( const char* sym, quint8 flags ) { Symbol::get(sym)->flags = flags; }
+};
+
+class TokenSource
+{
+public:
+    virtual ~TokenSource() {}
+    virtual Token nextToken() = 0;
 };
 
-class Lexer : public QObject
+class Lexer : public QObject, public TokenSource
 {
 public:
     Lexer(QObject *parent = 0);
@@ -82,16 +111,19 @@ public:
     void setStream( QIODevice*, const QString& sourcePath );
     void setStream(const QByteArray& code, const QString& sourcePath );
     bool setStream(const QString& sourcePath);
+    // the lexer reads directly from the borrowed buffer; the caller keeps it alive
+    void setStream(const char* data, int len, const QString& sourcePath, quint32 start = 0 );
 
     Token nextToken();
     Token readString();
     void unget(const Token&);
     QList<Token> tokens( const QString& code );
     QList<Token> tokens( const QByteArray& code, const QString& path = QString() );
-    QString getSource() const { return sourcePath; }
+    const QString& getSource() const { return sourcePath; }
     void setEmitComments(bool on) { emitComments = on; }
     void setPacked(bool on) { packed = on; }
-    RowCol getPos() const { return pos; }
+    quint32 getPos() const { return pos; }
+    const LineTable& getLines() const { return lines; }
     void startQuote();
     void endQuote();
 
@@ -101,7 +133,10 @@ protected:
     Token nextTokenImp();
     char readc();
     void ungetc(char c);
-    QByteArray peek(int count);
+    bool getChar(char& c);
+    void ungetChar(char c);
+    bool atEnd() const;
+    char peekc(int i = 0);
     void ungetstr(const QByteArray& str);
     Token token(TokenType tt, int len = 0, const QByteArray &val = QByteArray());
     Token number();
@@ -112,7 +147,13 @@ protected:
 
 private:
     QIODevice* in;
-    RowCol pos, start;
+    const char* data; // borrowed buffer, used if in is null
+    int dataLen, dataPos;
+    QByteArray pushback; // chars ungot in front of data which differ from data
+    QByteArray scratch; // reused by atom()
+    char last;
+    quint32 pos, start;
+    LineTable lines;
     QString sourcePath;
     QList<Token> buffer;
     bool emitComments;
@@ -0,0 +1,572 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include "LispMachine.h"
+#include "LispEvaluator.h"
+#include "LispLexer.h"
+#include "LispProject.h"
+using namespace Lisp;
+
+typedef Reader::Object Object;
+
+enum { StackSize = 1 << 18, MaxFrames = 100000 };
+
+#ifdef LISP_THREADED_CODE
+static void* const* s_handlers = 0; // opcode -> address of its handler in execute()
+#endif
+
+#define U16(p) quint16((p)[0] << 8 | (p)[1])
+
+static inline bool toInt(const Object& o, qint64& i)
+{
+    if( o.type() == Object::Integer )
+        i = o.getInt();
+    else if( o.type() == Object::Float )
+        i = qint64(o.getDouble());
+    else
+        return false;
+    return true;
+}
+
+Machine::Machine(Evaluator* e):e(e),top(0)
+{
+    Q_ASSERT(e);
+    stack.resize(StackSize);
+    e->getHeap()->addRoots(this);
+}
+
+Machine::~Machine()
+{
+    e->getHeap()->removeRoots(this);
+    qDeleteAll(codes);
+}
+
+void Machine::load(const Object& ast)
+{
+    e->load(ast);
+    if( ast.type() != Object::List_ )
+        return;
+    const quint32 defineq = Token::getSymbolId(Token::getSymbol("DEFINEQ").constData());
+    const Reader::List* top = ast.getList();
+    for( int i = 0; i < top->list.size(); i++ )
+    {
+        if( top->list[i].type() != Object::List_ )
+            continue;
+        const Reader::List* form = top->list[i].getList();
+        if( form->list.isEmpty() || form->list.first().getAtomId() != defineq )
+            continue;
+        for( int j = 1; j < form->list.size(); j++ )
+        {
+            if( form->list[j].type() != Object::List_ )
+                continue;
+            const Reader::List* def = form->list[j].getList();
+            if( def->list.size() == 2 && def->list.first().type() == Object::Atom_ )
+                define(def->list.first().getAtomId(), def->list[1]);
+        }
+    }
+}
+
+bool Machine::define(quint32 atom, const Object& lambda)
+{
+    e->define(atom, lambda);
+    if( codes.size() < int(Token::getSymbolCount()) )
+        codes.resize(Token::getSymbolCount());
+    if( atom >= quint32(codes.size()) )
+        return false;
+    delete codes[atom];
+    codes[atom] = compiler.compile(atom, lambda);
+    if( codes[atom] )
+        prepare(codes[atom]);
+    else
+        compileErrors << QString("%1: %2").arg(Project::decode(Token::getSymbolById(atom)))
+                         .arg(compiler.getError());
+    return codes[atom] != 0;
+}
+
+const Code* Machine::getCode(quint32 atom) const
+{
+    return atom < quint32(codes.size()) ? codes[atom] : 0;
+}
+
+Code* Machine::compile(const Object& form)
+{
+    // the form is compiled as the body of a LAMBDA without parameters; cells built at runtime are
+    // left to the Evaluator, since the Compiler only walks the lists of the Reader
+    if( form.type() == Object::Cons_ )
+        return 0;
+    Reader::List* l = new Reader::List();
+    const Object lambda(l);
+    Object head;
+    head.setAtom(Token::getSymbolId(Token::getSymbol("LAMBDA").constData()));
+    l->list << head << Object() << form;
+    Code* c = compiler.compile(0, lambda);
+    if( c )
+        prepare(c);
+    return c;
+}
+
+Object Machine::run(const Code* c)
+{
+    Q_ASSERT(c);
+    return execute(c, 0, 0);
+}
+
+Object Machine::run(const Object& form)
+{
+    Code* c = compile(form);
+    if( c == 0 )
+    {
+        const Object res = e->run(form);
+        error = e->getError();
+        return res;
+    }
+    const Object res = run(c);
+    delete c;
+    return res;
+}
+
+Object Machine::call(quint32 atom, const Object* args, int count)
+{
+    const Code* c = getCode(atom);
+    if( c )
+        return execute(c, args, count);
+    Object fn;
+    fn.setAtom(atom);
+    e->clearError();
+    const Object res = e->apply(fn, args, count);
+    error = e->getError();
+    return res;
+}
+
+void Machine::markRoots(Heap* h)
+{
+    // the constants of the Code are the cells of quoted source lists, which the Evaluator keeps
+    for( int i = 0; i < top; i++ )
+        h->mark(stack[i]);
+}
+
+Machine::Pc Machine::entry(const Code* c)
+{
+#ifdef LISP_THREADED_CODE
+    return c->threaded.constData();
+#else
+    return (const quint8*)c->ops.constData();
+#endif
+}
+
+void Machine::prepare(Code* c)
+{
+    // quoted lists are cells at runtime, like in the Evaluator, and EQ to the ones it returns
+    for( int i = 0; i < c->consts.size(); i++ )
+        c->consts[i] = e->data(c->consts[i]);
+    translate(c);
+}
+
+void Machine::translate(Code* c)
+{
+#ifdef LISP_THREADED_CODE
+    // each opcode becomes the address of its handler and each operand a cell of its own; the
+    // jump distances are converted from bytes to cells
+    if( s_handlers == 0 )
+        execute(0, 0, 0);
+    const int n = c->ops.size();
+    const quint8* ops = (const quint8*)c->ops.constData();
+    QVector<int> cells(n + 1); // byte offset of an instruction -> its cell index
+    int cell = 0;
+    for( int i = 0; i < n; i += 1 + Code::operands(ops[i]) )
+    {
+        cells[i] = cell;
+        cell += 1 + ( ops[i] == Code::FN ? 2 : Code::operands(ops[i]) > 0 ? 1 : 0 );
+    }
+    cells[n] = cell;
+    c->threaded.resize(cell);
+    qintptr* out = c->threaded.data();
+    for( int i = 0; i < n; i += 1 + Code::operands(ops[i]) )
+    {
+        const quint8 op = ops[i];
+        *out++ = qintptr(s_handlers[op]);
+        switch( op )
+        {
+        case Code::JUMP:
+        case Code::FJUMP:
+        case Code::TJUMP:
+        case Code::NFJUMP:
+        case Code::NTJUMP:
+            *out++ = cells[i + 3 + qint16(U16(ops + i + 1))] - ( cells[i] + 2 );
+            break;
+        case Code::FN:
+            *out++ = ops[i+1];
+            *out++ = U16(ops + i + 2);
+            break;
+        default:
+            if( Code::operands(op) == 1 )
+                *out++ = ops[i+1];
+            else if( Code::operands(op) == 2 )
+                *out++ = U16(ops + i + 1);
+            break;
+        }
+    }
+#else
+    Q_UNUSED(c);
+#endif
+}
+
+static inline int enter(Object* s, int bp, int count, const Code* c)
+{
+    // the args are at bp; missing args and the PVARs are already nil
+    for( int i = bp + c->nargs; i < bp + count; i++ )
+        s[i] = Object();
+    return bp + c->nargs + c->npvars;
+}
+
+Object Machine::execute(const Code* c, const Object* args, int count)
+{
+#ifdef LISP_THREADED_CODE
+#define LISP_OP_LABEL(name, len, effect) &&L_##name,
+    static void* const labels[] = { LISP_OPCODES(LISP_OP_LABEL) };
+#undef LISP_OP_LABEL
+    if( c == 0 )
+    {
+        s_handlers = labels; // called by translate()
+        return Object();
+    }
+#endif
+    error.clear();
+    e->clearError();
+    frames.clear();
+    Object* s = stack.data();
+    Heap* heap = e->getHeap();
+    const Object nil;
+    const Object t = e->boolean(true);
+    Object res;
+    qint64 x, y;
+    if( c->nargs + c->npvars + c->maxStack + count >= StackSize )
+    {
+        error = "stack overflow";
+        return Object();
+    }
+    for( int i = 0; i < count; i++ )
+        s[i] = args[i];
+    const Code* code = c;
+    int bp = 0;
+    int pv = code->nargs;
+    int sp = enter(s, bp, count, code);
+    Pc pc = entry(code);
+
+    // ARG1 and ARG2 fetch an operand, OFF is the distance of a jump from the end of its operand,
+    // TAKE jumps and SKIP steps over the operand of a jump which is not taken
+#ifdef LISP_THREADED_CODE
+#define CASE(name) L_##name:
+#define NEXT goto *(void*)*pc++
+#define ARG1 quint8(*pc++)
+#define ARG2 quint16(*pc++)
+#define OFF (*pc)
+#define TAKE pc += 1 + *pc
+#define SKIP pc++
+    NEXT;
+#else
+#define CASE(name) case Code::name:
+#define NEXT continue
+#define ARG1 (*pc++)
+#define ARG2 (pc += 2, U16(pc - 2))
+#define OFF qint16(U16(pc))
+#define TAKE pc += 2 + qint16(U16(pc))
+#define SKIP pc += 2
+    for(;;)
+    {
+        switch( *pc++ )
+        {
+#endif
+        CASE(NIL)
+            s[sp++] = nil;
+            NEXT;
+        CASE(T)
+            s[sp++] = t;
+            NEXT;
+        CASE(SIC)
+            s[sp++] = Object(qint64(qint8(ARG1)));
+            NEXT;
+        CASE(GCONST)
+            s[sp++] = code->consts[ARG2];
+            NEXT;
+        CASE(COPY)
+            s[sp] = s[sp-1];
+            sp++;
+            NEXT;
+        CASE(POP)
+            s[--sp] = nil;
+            NEXT;
+        CASE(POPN)
+            for( int n = ARG1; n > 0; n-- )
+                s[--sp] = nil;
+            NEXT;
+        CASE(UNWIND)
+            {
+                // keeps the top and drops n values below it
+                const int n = ARG1;
+                s[sp-1-n] = s[sp-1];
+                for( int i = sp - n; i < sp; i++ )
+                    s[i] = nil;
+                sp -= n;
+            }
+            NEXT;
+        CASE(SWAP)
+            {
+                const Object tmp = s[sp-1];
+                s[sp-1] = s[sp-2];
+                s[sp-2] = tmp;
+            }
+            NEXT;
+        CASE(IVAR)
+            s[sp++] = s[bp + ARG1];
+            NEXT;
+        CASE(PVAR)
+            s[sp++] = s[pv + ARG1];
+            NEXT;
+        CASE(GVAR)
+            {
+                const quint32 atom = code->atoms[ARG2];
+                if( !e->isBound(atom) )
+                {
+                    error = QString("unbound atom %1").arg(Token::getSymbolById(atom));
+                    goto Error;
+                }
+                s[sp++] = e->getValue(atom);
+            }
+            NEXT;
+        CASE(IVARX_)
+            s[bp + ARG1] = s[sp-1];
+            NEXT;
+        CASE(PVARX_)
+            s[pv + ARG1] = s[sp-1];
+            NEXT;
+        CASE(GVAR_)
+            e->setValue(code->atoms[ARG2], s[sp-1]);
+            NEXT;
+        CASE(JUMP)
+            {
+                const bool back = OFF < 0;
+                TAKE;
+                if( back && heap->isDue() )
+                {
+                    // a safe point in loops
+                    top = sp;
+                    heap->collectIfDue();
+                    top = 0;
+                }
+            }
+            NEXT;
+        CASE(FJUMP)
+            sp--;
+            if( e->isNil(s[sp]) )
+                TAKE;
+            else
+                SKIP;
+            s[sp] = nil;
+            NEXT;
+        CASE(TJUMP)
+            sp--;
+            if( !e->isNil(s[sp]) )
+                TAKE;
+            else
+                SKIP;
+            s[sp] = nil;
+            NEXT;
+        CASE(NFJUMP)
+            if( e->isNil(s[sp-1]) )
+                TAKE;
+            else
+            {
+                s[--sp] = nil;
+                SKIP;
+            }
+            NEXT;
+        CASE(NTJUMP)
+            if( !e->isNil(s[sp-1]) )
+                TAKE;
+            else
+            {
+                s[--sp] = nil;
+                SKIP;
+            }
+            NEXT;
+        CASE(FN)
+            {
+                const int argc = ARG1;
+                const quint32 atom = code->atoms[ARG2];
+                const Code* callee = atom < quint32(codes.size()) ? codes[atom] : 0;
+                if( callee )
+                {
+                    if( heap->isDue() )
+                    {
+                        // a safe point in recursions
+                        top = sp;
+                        heap->collectIfDue();
+                        top = 0;
+                    }
+                    const int base = sp - argc;
+                    if( frames.size() >= MaxFrames ||
+                            base + callee->nargs + callee->npvars + callee->maxStack >= StackSize )
+                    {
+                        error = "stack overflow";
+                        goto Error;
+                    }
+                    frames.append(Frame(code, pc, bp, pv));
+                    code = callee;
+                    pc = entry(code);
+                    bp = base;
+                    pv = bp + code->nargs;
+                    sp = enter(s, bp, argc, code);
+                }else
+                {
+                    Object fn;
+                    fn.setAtom(atom);
+                    top = sp; // the Evaluator may collect
+                    const Object v = e->apply(fn, s + sp - argc, argc);
+                    top = 0;
+                    if( e->hasError() )
+                    {
+                        error = e->getError();
+                        goto Error;
+                    }
+                    for( int i = sp - argc; i < sp; i++ )
+                        s[i] = nil;
+                    sp -= argc;
+                    s[sp++] = v;
+                }
+            }
+            NEXT;
+        CASE(RETURN)
+            {
+                const Object v = s[sp-1];
+                while( sp > bp )
+                    s[--sp] = nil;
+                if( frames.isEmpty() )
+                {
+                    res = v;
+                    goto Done;
+                }
+                s[sp++] = v;
+                const Frame& f = frames.last();
+                code = f.code;
+                pc = f.pc;
+                bp = f.bp;
+                pv = f.pv;
+                frames.pop_back();
+            }
+            NEXT;
+        CASE(CAR)
+            if( s[sp-1].type() == Object::List_ )
+                s[sp-1] = e->data(s[sp-1]); // a LAMBDA of the source
+            if( s[sp-1].type() == Object::Cons_ )
+            {
+                const Object v = s[sp-1].getCons()->car;
+                s[sp-1] = v;
+            }else if( e->isNil(s[sp-1]) )
+                s[sp-1] = nil;
+            else
+            {
+                error = "CAR of a non-list";
+                goto Error;
+            }
+            NEXT;
+        CASE(CDR)
+            if( s[sp-1].type() == Object::List_ )
+                s[sp-1] = e->data(s[sp-1]);
+            if( s[sp-1].type() == Object::Cons_ )
+            {
+                const Object v = s[sp-1].getCons()->cdr;
+                s[sp-1] = v;
+            }else if( e->isNil(s[sp-1]) )
+                s[sp-1] = nil;
+            else
+            {
+                error = "CDR of a non-list";
+                goto Error;
+            }
+            NEXT;
+        CASE(CONS)
+            {
+                const Object v = e->cons(s[sp-2], e->isNil(s[sp-1]) ? nil : e->data(s[sp-1]));
+                s[--sp] = nil;
+                s[sp-1] = v;
+            }
+            NEXT;
+        CASE(EQ)
+            {
+                const bool eq = s[sp-2].isSame(s[sp-1]) || ( e->isNil(s[sp-2]) && e->isNil(s[sp-1]) );
+                s[--sp] = nil;
+                s[sp-1] = eq ? t : nil;
+            }
+            NEXT;
+        CASE(LISTP)
+            s[sp-1] = s[sp-1].type() == Object::Cons_ ||
+                    ( s[sp-1].type() == Object::List_ && !e->isNil(s[sp-1]) ) ? t : nil;
+            NEXT;
+        CASE(IPLUS2)
+            if( !toInt(s[sp-2], x) || !toInt(s[sp-1], y) )
+                goto NonNumeric;
+            s[--sp] = nil;
+            s[sp-1] = Object(x + y);
+            NEXT;
+        CASE(IDIFFERENCE)
+            if( !toInt(s[sp-2], x) || !toInt(s[sp-1], y) )
+                goto NonNumeric;
+            s[--sp] = nil;
+            s[sp-1] = Object(x - y);
+            NEXT;
+        CASE(ITIMES2)
+            if( !toInt(s[sp-2], x) || !toInt(s[sp-1], y) )
+                goto NonNumeric;
+            s[--sp] = nil;
+            s[sp-1] = Object(x * y);
+            NEXT;
+        CASE(IGREATERP)
+            if( !toInt(s[sp-2], x) || !toInt(s[sp-1], y) )
+                goto NonNumeric;
+            s[--sp] = nil;
+            s[sp-1] = x > y ? t : nil;
+            NEXT;
+#ifndef LISP_THREADED_CODE
+        default:
+            error = QString("invalid opcode %1").arg(pc[-1]);
+            goto Error;
+        }
+    }
+#endif
+#undef CASE
+#undef NEXT
+#undef ARG1
+#undef ARG2
+#undef OFF
+#undef TAKE
+#undef SKIP
+
+NonNumeric:
+    error = QString("non-numeric arg %1").arg(( toInt(s[sp-2], x) ? s[sp-1] : s[sp-2] ).toString().constData());
+Error:
+    while( sp > 0 )
+        s[--sp] = nil;
+    frames.clear();
+    return Object();
+Done:
+    return res;
+}
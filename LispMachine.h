@@ -0,0 +1,96 @@
+#ifndef LISPMACHINE_H
+#define LISPMACHINE_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include "LispCompiler.h"
+#include "LispHeap.h"
+
+// GCC and Clang support labels as values; the Code is then translated to direct threaded code,
+// where each opcode is replaced by the address of its handler, and each handler jumps to the
+// next one instead of going back to a central switch.
+#if defined(__GNUC__) && !defined(LISP_NO_THREADED_CODE)
+#define LISP_THREADED_CODE
+#endif
+
+namespace Lisp
+{
+
+class Evaluator;
+
+// A stack VM for the Code of the Compiler. Calls between compiled functions push a frame without
+// recursion in C; calls of primitives and of functions which could not be compiled, as well as
+// GVAR access, go through the Evaluator, whose value cells are the global variables. Since all
+// live values are on its stack, the Machine collects the Heap of the Evaluator at calls and
+// backward jumps, and the stack is traced while the Evaluator runs on behalf of the Machine; it
+// has to be deleted before the Evaluator.
+class Machine : public Heap::Roots
+{
+public:
+    typedef Reader::Object Object;
+
+    Machine(Evaluator*);
+    ~Machine();
+
+    void load(const Object& ast); // loads ast into the Evaluator and compiles its DEFINEQ functions
+    bool define(quint32 atom, const Object& lambda); // false if lambda is only defined in the Evaluator
+    const Code* getCode(quint32 atom) const;
+    QStringList getCompileErrors() const { return compileErrors; }
+
+    Object run(const Object& form); // compiles and runs form, or falls back to the Evaluator
+    Code* compile(const Object& form); // for repeated runs; the caller owns the result, 0 on error
+    Object run(const Code*); // runs a result of compile(form)
+    Object call(quint32 atom, const Object* args, int count);
+    bool hasError() const { return !error.isEmpty(); }
+    const QString& getError() const { return error; }
+    void markRoots(Heap*);
+private:
+#ifdef LISP_THREADED_CODE
+    typedef const qintptr* Pc;
+#else
+    typedef const quint8* Pc;
+#endif
+    struct Frame
+    {
+        const Code* code;
+        Pc pc;
+        int bp, pv;
+        Frame(const Code* c = 0, Pc p = 0, int b = 0, int v = 0):code(c),pc(p),bp(b),pv(v){}
+    };
+    static Pc entry(const Code*);
+    void prepare(Code*);
+    void translate(Code*);
+    Object execute(const Code*, const Object* args, int count);
+
+    Evaluator* e;
+    Compiler compiler;
+    QVector<Code*> codes; // atom id -> compiled function or null
+    QVector<Object> stack; // everything above the stack pointer is nil
+    int top; // the stack pointer at the last safe point
+    QVector<Frame> frames;
+    QStringList compileErrors;
+    QString error;
+};
+
+}
+
+#endif // LISPMACHINE_H
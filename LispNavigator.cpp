@@ -21,8 +21,11 @@
 #include "LispNavigator.h"
 #include "LispReader.h"
 #include "LispLexer.h"
-#include "LispBuiltins.h"
 #include "LispHighlighter.h"
+#include "LispTrace.h"
+#include "LispDiff.h"
+#include "LispBench.h"
+#include "LispCompiler.h"
 #include <GuiTools/CodeEditor.h>
 #include <GuiTools/AutoMenu.h>
 #include <GuiTools/AutoShortcut.h>
@@ -43,8 +46,19 @@
 #include <QShortcut>
 #include <QInputDialog>
 #include <QListWidget>
+#include <QSet>
+#include <QCheckBox>
+#include <QLineEdit>
+#include <QTimer>
 #include <QElapsedTimer>
+#include <QTextStream>
 #include <QFileDialog>
+#include <QCache>
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QPainter>
+#include <QResizeEvent>
+#include <algorithm>
 
 static Navigator* s_this = 0;
 static void report(QtMsgType type, const QString& message )
@@ -78,26 +92,20 @@ void messageHander(QtMsgType type, const QMessageLogContext& ctx, const QString&
 class Navigator::Viewer : public CodeEditor
 {
 public:
-    Viewer(Navigator* p):CodeEditor(p),d_ide(p),d_list(0)
+    enum { MaxCachedDocs = 8 };
+
+    Viewer(Navigator* p):CodeEditor(p),d_ide(p),d_list(0),d_form(0)
     {
         setCharPerTab(3);
         setShowNumbers(true);
         setPaintIndents(false);
         setReadOnly(true);
         installDefaultPopup();
-        d_hl = new Lisp::Highlighter( document() );
-        for(int i = 0; Lisp::Builtins::functions[i]; i++)
-        {
-            const char* str = Lisp::Builtins::functions[i];
-            d_hl->addFunction(Lisp::Token::getSymbol(QByteArray::fromRawData(str, strlen(str))).constData());
-            str++;
-        }
-        for(int i = 0; Lisp::Builtins::variables[i]; i++)
-        {
-            const char* str = Lisp::Builtins::variables[i];
-            d_hl->addVariable(Lisp::Token::getSymbol(QByteArray::fromRawData(str, strlen(str))).constData());
-            str++;
-        }
+        d_scratch = document();
+        d_hl = createHighlighter( d_scratch );
+        d_cache.setMaxCost(MaxCachedDocs);
+        // the current line and the list nesting are painted by paintEvent
+        connect(this, SIGNAL(cursorPositionChanged()), viewport(), SLOT(update()));
 
         QSettings set;
         if( !set.contains("CodeEditor/Font") )
@@ -121,36 +129,104 @@ public:
 
     ~Viewer()
     {
+        setDocument(d_scratch); // the cached documents are deleted before the editor
     }
 
     Navigator* d_ide;
     Lisp::Highlighter* d_hl;
     Lisp::Reader::List* d_list;
+    QTextDocument* d_scratch; // the document owned by the editor, used for messages and generated code
+    QCache<QString,QTextDocument> d_cache; // path -> decoded and highlighted document, most recently used
 
-    void clearBackHisto()
+    static Lisp::Highlighter* createHighlighter(QTextDocument* doc)
     {
-        d_backHisto.clear();
+        return new Lisp::Highlighter( doc );
     }
 
-    void markNonTerms(const Lisp::Reader::Refs& syms)
+    void switchDocument(QTextDocument* doc)
     {
-        d_nonTerms.clear();
-        QTextCharFormat format;
-        format.setBackground( QColor(237,235,243) );
-        foreach( const Lisp::Reader::Ref& s, syms )
-        {
-            QTextCursor c( document()->findBlockByNumber( qMax(int(s.pos.row - 1),0)) );
-            c.setPosition( c.position() + qMax(int(s.pos.col - 1), 0) );
-            int pos = c.position();
-            c.setPosition( pos + s.len, QTextCursor::KeepAnchor );
+        if( doc == document() )
+            return;
+        // the extra selections, spans and marks refer to the previous document
+        d_marks.clear();
+        d_link.clear();
+        d_nesting.clear();
+        d_form = 0;
+        setDocument(doc);
+        d_hl = static_cast<Lisp::Highlighter*>(doc->findChild<QSyntaxHighlighter*>());
+        updateTabWidth();
+    }
 
-            QTextEdit::ExtraSelection sel;
-            sel.format = format;
-            sel.cursor = c;
+    void highlightViewport()
+    {
+        // the visible blocks plus one page below
+        const int page = viewport()->height() / qMax(fontMetrics().height(), 1) + 1;
+        if( d_hl )
+            d_hl->highlightUpTo(firstVisibleBlock().blockNumber() + 2 * page);
+    }
 
-            d_nonTerms << sel;
-        }
+    void scrollContentsBy(int dx, int dy)
+    {
+        CodeEditor::scrollContentsBy(dx, dy);
+        highlightViewport();
+    }
+
+    void resizeEvent(QResizeEvent* e)
+    {
+        CodeEditor::resizeEvent(e);
+        highlightViewport();
+    }
+
+    bool showCached(const QString& path)
+    {
+        QTextDocument* doc = d_cache.object(path); // also makes it the most recently used one
+        if( doc == 0 )
+            return false;
+        switchDocument(doc);
+        d_path = path;
         updateExtraSelections();
+        highlightViewport();
+        return true;
+    }
+
+    void loadDocument(const QString& text, const QString& path)
+    {
+        QTextDocument* doc = new QTextDocument();
+        doc->setDocumentLayout(new QPlainTextDocumentLayout(doc));
+        doc->setDefaultFont(font());
+        createHighlighter(doc);
+        switchDocument(doc);
+        loadFromString(text, path);
+        highlightViewport();
+        // doc is shown and thus most recently used, so it is never the one evicted here
+        d_cache.insert(path, doc);
+    }
+
+    void showMessage(const QString& text)
+    {
+        switchDocument(d_scratch);
+        d_hl->reset();
+        setPlainText(text);
+        highlightViewport();
+    }
+
+    void clearCache()
+    {
+        switchDocument(d_scratch);
+        d_hl->reset(); // the scratch document is cleared next
+        d_cache.clear();
+    }
+
+    void clearBackHisto()
+    {
+        d_backHisto.clear();
+    }
+
+    void markNonTerms(const Lisp::Reader::Refs& syms)
+    {
+        // the refs are in source order as produced by the Reader; only the visible ones are painted
+        d_marks = syms;
+        viewport()->update();
     }
 
     static inline void crosslineColors(QTextCharFormat& f, int level)
@@ -165,54 +241,176 @@ public:
         return QColor(180 + rand() % 76, 180 + rand() % 76, 180 + rand() % 76);
     }
 
-    void colorList( ESL& sum, Lisp::Reader::List* l, int level = 0 )
+    struct Span
     {
-        const Lisp::RowCol start = l->getStart();
-
-        QTextCursor a( document()->findBlockByNumber( start.row - 1) );
-        //a.setPosition( a.position() + start.col - 1 + 1 ); // without lpar
-        a.setPosition( a.position() + start.col - 1 ); // with lpar
-        QTextCursor b( document()->findBlockByNumber( l->end.row - 1) );
-        b.setPosition( b.position() + l->end.col - 1 );
-        const int posb = b.position();
-        //a.setPosition( posb, QTextCursor::KeepAnchor ); // without rpar
-        a.setPosition( posb + 1, QTextCursor::KeepAnchor ); // with rpar
-
-        QTextEdit::ExtraSelection sel;
+        int start, end; // document positions, end exclusive
+        QColor color;
+        Span(int s = 0, int e = 0, const QColor& c = QColor()):start(s),end(e),color(c){}
+    };
+    typedef QVector<Span> Spans;
+    Spans d_nesting; // the lists of d_form, outer before inner
+    Lisp::Reader::Refs d_marks; // usages of the selected atom in this file, sorted by position
+    Lisp::Reader::List* d_form; // the list d_nesting was computed for
+
+    void colorList( Lisp::Reader::List* l, quint32 start, int level = 0 )
+    {
+        // with lpar and rpar; source offsets are document positions since Project::decode() and the Lexer agree
+        const int a = start;
+        const int b = l->end + 1;
 #if 1
-        //sel.format.setBackground(QColor(Qt::red).lighter(195 - (level % 10) * 5));
-        sel.format.setBackground(QColor(Qt::red).lighter(195 - level * 5));
+        //d_nesting.append(Span(a, b, QColor(Qt::red).lighter(195 - (level % 10) * 5)));
+        d_nesting.append(Span(a, b, QColor(Qt::red).lighter(195 - level * 5)));
 #else
         if( level < 9 )
-            sel.format.setBackground(QColor(Qt::red).lighter(195 - level * 5));
+            d_nesting.append(Span(a, b, QColor(Qt::red).lighter(195 - level * 5)));
         else
-            sel.format.setBackground(QColor(Qt::magenta).lighter(195 - (level-7) * 5));
+            d_nesting.append(Span(a, b, QColor(Qt::magenta).lighter(195 - (level-7) * 5)));
 #endif
-        // crosslineColors(sel.format);
-        sel.cursor = a;
-        sum << sel;
-        for( int i = 0; i < l->list.size(); i++ )
+        for( int i = 0; i < l->list.size() && i < l->elementPositions.size(); i++ )
         {
             if( l->list[i].type() == Lisp::Reader::Object::List_ )
-                colorList(sum, l->list[i].getList(), level + 1);
+                colorList(l->list[i].getList(), l->elementPositions[i], level + 1);
         }
     }
 
-    void updateExtraSelections()
+    void updateNesting()
     {
-        ESL sum;
+        Lisp::Reader::List* form = d_list && d_list->outer ? d_list : 0;
+        if( form == d_form )
+            return;
+        d_form = form;
+        d_nesting.clear();
+        if( d_form )
+            colorList(d_form, d_form->getStart());
+        viewport()->update();
+    }
 
-        QTextEdit::ExtraSelection line;
-        line.format.setBackground(QColor(Qt::yellow).lighter(170));
-        line.format.setProperty(QTextFormat::FullWidthSelection, true);
-        line.cursor = textCursor();
-        line.cursor.clearSelection();
-        sum << line;
+    typedef QList<QPair<QTextBlock,QPointF> > Blocks;
 
-        if( d_list && d_list->outer )
-            colorList(sum, d_list);
+    Blocks visibleBlocks(const QRect& clip)
+    {
+        // the same block walk as QPlainTextEdit::paintEvent
+        Blocks blocks;
+        QPointF offset = contentOffset();
+        QTextBlock block = firstVisibleBlock();
+        while( block.isValid() )
+        {
+            const QRectF r = blockBoundingRect(block).translated(offset);
+            if( r.top() > clip.bottom() )
+                break;
+            if( block.isVisible() && r.bottom() >= clip.top() )
+                blocks.append(qMakePair(block,offset));
+            offset.ry() += r.height();
+            block = block.next();
+        }
+        return blocks;
+    }
 
-        sum << d_nonTerms;
+    void paintRange(QPainter& p, const QPair<QTextBlock,QPointF>& b, int a, int z, bool continues, const QColor& color)
+    {
+        // a and z are relative to the block; continues means the range goes on in the next block
+        const QTextLayout* layout = b.first.layout();
+        const QPointF pos = b.second + layout->position();
+        for( int k = 0; k < layout->lineCount(); k++ )
+        {
+            const QTextLine line = layout->lineAt(k);
+            const int ls = line.textStart();
+            const int le = ls + line.textLength();
+            const bool beyond = continues || z > le;
+            const int from = qMax(a, ls);
+            const int to = qMin(z, le);
+            if( from > to || ( from == to && !beyond ) )
+                continue;
+            const qreal x1 = line.cursorToX(from);
+            qreal x2 = line.cursorToX(to);
+            if( beyond )
+            {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+                x2 += fontMetrics().horizontalAdvance(QLatin1Char(' '));
+#else
+                x2 += fontMetrics().width(QLatin1Char(' '));
+#endif
+            }
+            p.fillRect(QRectF(pos.x() + x1, pos.y() + line.y(), x2 - x1, line.height()), color);
+        }
+    }
+
+    void paintSpans(QPainter& p, const Blocks& blocks, const Spans& spans)
+    {
+        if( spans.isEmpty() || blocks.isEmpty() )
+            return;
+
+        const int from = blocks.first().first.position();
+        const int to = blocks.last().first.position() + blocks.last().first.length();
+        QVector<const Span*> visible;
+        for( int i = 0; i < spans.size(); i++ )
+        {
+            if( spans[i].start < to && spans[i].end > from )
+                visible.append(&spans[i]);
+        }
+
+        for( int i = 0; i < blocks.size() && !visible.isEmpty(); i++ )
+        {
+            const int bpos = blocks[i].first.position();
+            const int bend = bpos + blocks[i].first.length() - 1; // without the paragraph separator
+            for( int j = 0; j < visible.size(); j++ )
+            {
+                const Span& s = *visible[j];
+                if( s.start > bend || s.end <= bpos )
+                    continue;
+                paintRange(p, blocks[i], qMax(s.start, bpos) - bpos, qMin(s.end, bend) - bpos, s.end > bend,
+                           s.color);
+            }
+        }
+    }
+
+    static bool lessPos(const Lisp::Reader::Ref& lhs, quint32 pos)
+    {
+        return lhs.pos < pos;
+    }
+
+    void paintMarks(QPainter& p, const Blocks& blocks)
+    {
+        if( d_marks.isEmpty() || blocks.isEmpty() )
+            return;
+        const QColor color(237,235,243);
+        // d_marks is sorted by position, so the visible ones are found by binary search
+        const Lisp::Reader::Refs::const_iterator end = d_marks.constEnd();
+        Lisp::Reader::Refs::const_iterator i = std::lower_bound(d_marks.constBegin(), end,
+                                                    quint32(blocks.first().first.position()), lessPos);
+        for( int j = 0; j < blocks.size() && i != end; j++ )
+        {
+            const quint32 bpos = blocks[j].first.position();
+            const quint32 bend = bpos + blocks[j].first.length();
+            while( i != end && (*i).pos < bpos )
+                ++i;
+            while( i != end && (*i).pos < bend )
+            {
+                const int a = (*i).pos - bpos;
+                paintRange(p, blocks[j], a, a + (*i).len, false, color);
+                ++i;
+            }
+        }
+    }
+
+    void paintEvent(QPaintEvent* e)
+    {
+        QPainter p(viewport());
+        p.setClipRect(e->rect());
+        const QRect cur = cursorRect();
+        p.fillRect(QRect(0, cur.top(), viewport()->width(), cur.height()), QColor(Qt::yellow).lighter(170));
+        const Blocks blocks = visibleBlocks(e->rect());
+        paintSpans(p, blocks, d_nesting);
+        paintMarks(p, blocks);
+        p.end();
+        CodeEditor::paintEvent(e);
+    }
+
+    void updateExtraSelections()
+    {
+        ESL sum;
+
+        updateNesting();
 
 
         sum << d_link;
@@ -233,8 +431,16 @@ public:
         if( QApplication::keyboardModifiers() == Qt::ControlModifier )
         {
             QTextCursor cur = cursorForPosition(e->pos());
-            QPair<Lisp::Reader::List*,int> res = d_ide->findSymbolBySourcePos(
-                        getPath(),cur.blockNumber() + 1,cur.positionInBlock() + 1);
+            QPair<Lisp::Reader::List*,int> res = d_ide->findSymbolBySourcePos(getPath(),cur.position());
+            if( res.first && res.second >= 0 && res.first->list[res.second].type() == Lisp::Reader::Object::Atom_ )
+            {
+                // pushed before the jump, which pushes the target; if there is no jump, the
+                // same location is pushed below, which is a no-op
+                d_ide->pushLocation( Navigator::Location( getPath(), cur.blockNumber(), cur.positionInBlock(), verticalScrollBar()->value() ) );
+                if( d_ide->showDefinition(res.first->list[res.second].getAtom(), getPath(),
+                                          res.first->elementPositions[res.second]) )
+                    return;
+            }
             if( res.first && res.first->outer )
                 d_list = res.first;
             else
@@ -257,15 +463,13 @@ public:
         if( QApplication::keyboardModifiers() == Qt::ControlModifier )
         {
             QTextCursor cur = cursorForPosition(e->pos());
-            QPair<Lisp::Reader::List*,int> res = d_ide->findSymbolBySourcePos(
-                        getPath(),cur.blockNumber() + 1,cur.positionInBlock() + 1);
+            QPair<Lisp::Reader::List*,int> res = d_ide->findSymbolBySourcePos(getPath(),cur.position());
             const bool alreadyArrow = !d_link.isEmpty();
             d_link.clear();
             if( res.first && res.second >= 0 && res.first->list[res.second].type() == Lisp::Reader::Object::Atom_)
             {
                 Q_ASSERT( res.first );
-                const int off = cur.positionInBlock() + 1 - res.first->elementPositions[res.second].col;
-                cur.setPosition(cur.position() - off);
+                cur.setPosition(res.first->elementPositions[res.second]);
                 cur.setPosition( cur.position() + res.first->list[res.second].getAtomLen(), QTextCursor::KeepAnchor );
 
                 QTextEdit::ExtraSelection sel;
@@ -325,6 +529,9 @@ Navigator::Navigator(QWidget *parent)
     createLog();
     createAtomList();
     createProperties();
+    createCallGraph();
+    createPropertyIndex();
+    createQuery();
 
     s_this = this;
     s_oldHandler = qInstallMessageHandler(messageHander);
@@ -350,130 +557,92 @@ Navigator::Navigator(QWidget *parent)
     new QShortcut(tr("CTRL+SHIFT+F"),this,SLOT(onSearchAtom()));
     new QShortcut(tr("CTRL+SHIFT+A"),this,SLOT(onSelectAtom()));
     new QShortcut(tr("CTRL+O"),this,SLOT(onOpen()) );
+    new QShortcut(tr("CTRL+SHIFT+O"),this,SLOT(onAddRoot()) );
+    new QShortcut(tr("CTRL+SHIFT+T"),this,SLOT(onSaveTrace()) );
 
 }
 
 Navigator::~Navigator()
 {
+    d_query.cancel();
+    d_query.wait();
+    qDeleteAll(prjs);
 
 }
 
-static inline QString debang( const QString& str )
+static inline QByteArray toBa(const char* atom)
 {
-    const int pos = str.lastIndexOf('!');
-    if( pos == -1 )
-        return str;
-    else
-        return str.left(pos);
+    return QByteArray::fromRawData(atom, Lisp::Symbol::get(atom)->len);
 }
 
-static QString decode(const QByteArray& source)
+void Navigator::load(const QStringList& roots)
 {
-    QByteArray bytes;
-    const int len = source.size();
-    for( int i = 0; i < len; i++ )
-    {
-        const char ch = source[i];
-        if( ch == '\r' )
-        {
-            if( i >= len-1 || source[i+1] != '\n' )
-                bytes += '\n';
-            else
-                bytes += ' ';
-        }else if( ch == '_' )
-            bytes += "←";
-        else if( ch == '^' )
-            bytes += "↑";
-        else if( isprint(ch) || isspace(ch) )
-            bytes += ch;
-        else if( !bytes.isEmpty() && bytes[bytes.size()-1] == '%' )
-            bytes += ' ';
-    }
-    return QString::fromUtf8(bytes);
+    setWindowTitle(QString("%1 - Interlisp Navigator %2").arg(roots.join(", ")).arg(QApplication::applicationVersion()));
+    if( !roots.isEmpty() )
+        QDir::setCurrent(roots.first());
+    tree->clear();
+    title->clear();
+    viewer->clearCache();
+    viewer->clear();
+    viewer->d_list = 0;
+    atomList->clear();
+    d_xref->clear();
+    properties->clear();
+    d_calls->clear();
+    d_callsAtom.clear();
+    d_holders->clear();
+    d_query.cancel();
+    d_query.wait(); // it reads the ASTs deleted below
+    d_queryTimer->stop();
+    d_queryResults->clear();
+    d_backHisto.clear();
+    d_forwardHisto.clear();
+    qDeleteAll(prjs);
+    prjs.clear();
+    foreach( const QString& root, roots )
+        addRoot(root);
 }
 
-static QStringList collectFiles( const QDir& dir )
+void Navigator::addRoot(const QString& path)
 {
-    QStringList res;
-    QStringList files = dir.entryList( QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name );
+    Lisp::Project* prj = new Lisp::Project();
+    prj->setRoot(path);
+    prjs.append(prj);
 
-    foreach( const QString& f, files )
-        res += collectFiles( QDir( dir.absoluteFilePath(f) ) );
-
-    const QStringList all = dir.entryList(QDir::Files, QDir::Name);
-    QMap<QString,QString> check;
-    bool hasCompiled = false;
-    foreach( const QString& a, all )
+    QFileIconProvider fip;
+    if( prjs.size() == 2 )
     {
-        QFileInfo info(a);
-        const QString suff = debang(info.suffix().toLower());
-        if( suff.isEmpty() || suff == "lisp" )
-            check.insert(debang(info.baseName().toLower()), a);
-        // not relibale; some source trees have lcom/dcom for a random subset of source files
-        // if( suff == "lcom" || suff == "dfasl" || suff == "dcom" )
-        //    hasCompiled = true;
+        // from now on each root gets its own top-level item
+        QTreeWidgetItem* first = new QTreeWidgetItem(1);
+        first->setText(0, QFileInfo(prjs.first()->root).fileName());
+        first->setToolTip(0, prjs.first()->root);
+        first->setIcon(0, fip.icon(QFileIconProvider::Folder));
+        first->addChildren(tree->invisibleRootItem()->takeChildren());
+        tree->addTopLevelItem(first);
     }
-
-    foreach( const QString& a, all )
+    QTreeWidgetItem* top = 0;
+    if( prjs.size() > 1 )
     {
-        QFileInfo info(a);
-        if( !hasCompiled )
-        {
-            const QString suff = debang(info.suffix().toLower());
-            if( suff == "dump" || suff == "lcom" || suff == "dfasl" || suff == "dcom" )
-                continue;
-            QFile f(dir.absoluteFilePath(a));
-            if( f.open(QIODevice::ReadOnly) )
-            {
-                const QString header = decode(f.read(20));
-                if( header.startsWith("(FILECREATED") || header.startsWith("(DEFINE-FILE-INFO") )
-                    res.append(f.fileName());
-                else
-                    qDebug() << "no source file" << f.fileName();
-            }
-        }else
-        {
-            const QString suff = debang(info.suffix().toLower());
-            if( suff == "lcom" || suff == "dfasl" || suff == "dcom" )
-            {
-                const QString name = check.value(debang(info.baseName().toLower()));
-                if( !name.isEmpty() )
-                    res.append(dir.absoluteFilePath(name));
-                else
-                    qDebug() << "no source found for" << dir.absoluteFilePath(a);
-            }
-        }
+        top = new QTreeWidgetItem(tree,1);
+        top->setText(0, QFileInfo(path).fileName());
+        top->setToolTip(0, path);
+        top->setIcon(0, fip.icon(QFileIconProvider::Folder));
     }
-    return res;
-}
-
-void Navigator::load(const QString& path)
-{
-    setWindowTitle(QString("%1 - Interlisp Navigator %2").arg(path).arg(QApplication::applicationVersion()));
-    QDir::setCurrent(path);
-    tree->clear();
-    title->clear();
-    viewer->clear();
-    viewer->d_list = 0;
-    asts.clear();
-    xref.clear();
-    atoms.clear();
-    atomList->clear();
-    root = path;
-    sourceFiles = collectFiles(path);
     QMap<QString,QTreeWidgetItem*> dirs;
-    QFileIconProvider fip;
-    foreach( const QString& f, sourceFiles)
+    foreach( const QString& f, prj->sourceFiles)
     {
         QFileInfo info(f);
         QString prefix = info.path().mid(path.size()+1);
-        QTreeWidgetItem* super = 0;
+        QTreeWidgetItem* super = top;
         if( !prefix.isEmpty() )
         {
             super = dirs.value(prefix);
             if( super == 0 )
             {
-                super = new QTreeWidgetItem(tree,1);
+                if( top )
+                    super = new QTreeWidgetItem(top,1);
+                else
+                    super = new QTreeWidgetItem(tree,1);
                 super->setText(0,prefix);
                 super->setIcon(0, fip.icon(QFileIconProvider::Folder));
                 dirs[prefix] = super;
@@ -484,7 +653,7 @@ void Navigator::load(const QString& path)
             item = new QTreeWidgetItem(super);
         else
             item = new QTreeWidgetItem(tree);
-        item->setText(0, debang(info.baseName()) );
+        item->setText(0, Lisp::Project::debang(info.baseName()) );
         item->setIcon(0, fip.icon(QFileIconProvider::File));
         item->setData(0,Qt::UserRole, f);
         item->setToolTip(0,f);
@@ -495,16 +664,39 @@ void Navigator::load(const QString& path)
         Lisp::Token t = lex.nextToken();
         while(t.isValid())
         {
-            qDebug() << t.getName() << t.pos.row << t.pos.col << t.val;
+            qDebug() << t.getName() << t.pos << t.val;
             t = lex.nextToken();
         }
         if( !t.isEof() )
-            qCritical() << t.getName() << t.pos.row << t.pos.col << t.val;
+            qCritical() << t.getName() << t.pos << t.val;
 #endif
     }
     QTimer::singleShot(500,this,SLOT(onRunParser()));
 }
 
+Lisp::Project* Navigator::projectOf(const QString& file) const
+{
+    Lisp::Project* res = 0;
+    foreach( Lisp::Project* p, prjs )
+    {
+        // the longest matching root wins in case roots are nested
+        if( file.startsWith(p->root + "/") && ( res == 0 || p->root.size() > res->root.size() ) )
+            res = p;
+    }
+    return res;
+}
+
+QString Navigator::displayName(const QString& file) const
+{
+    const Lisp::Project* p = projectOf(file);
+    if( p == 0 )
+        return file;
+    QString res = Lisp::Project::debang(file.mid(p->root.size()+1));
+    if( prjs.size() > 1 )
+        res = QFileInfo(p->root).fileName() + ": " + res;
+    return res;
+}
+
 void Navigator::logMessage(const QString& str)
 {
     d_msgLog->parentWidget()->show();
@@ -548,6 +740,8 @@ void Navigator::onXrefDblClicked()
     {
         Lisp::Reader::Ref sym = item->data(0,Qt::UserRole).value<Lisp::Reader::Ref>(); // Ref
         QString path = item->data(1,Qt::UserRole).toString(); // path
+        if( path.isEmpty() )
+            return; // a root item
         d_lock3 = true;
         showFile( path, sym.pos);
         d_lock3 = false;
@@ -556,22 +750,17 @@ void Navigator::onXrefDblClicked()
 
 void Navigator::onCursor()
 {
-    int line, col;
-    viewer->getCursorPosition( &line, &col );
-    line += 1;
-    col += 1;
-
-    QPair<Lisp::Reader::List*,int> res = findSymbolBySourcePos(viewer->getPath(), line, col);
+    QPair<Lisp::Reader::List*,int> res = findSymbolBySourcePos(viewer->getPath(), viewer->textCursor().position());
     if( res.first )
     {
         viewer->d_list = res.first;
         if( res.second >= 0 && res.first->list[res.second].type() == Lisp::Reader::Object::Atom_ )
         {
             const char* atom = res.first->list[res.second].getAtom();
-            Lisp::RowCol rc;
+            quint32 pos = Lisp::NoPos;
             if( res.second < res.first->elementPositions.size() )
-                rc = res.first->elementPositions[res.second];
-            syncSelectedAtom(atom,rc);
+                pos = res.first->elementPositions[res.second];
+            syncSelectedAtom(atom,pos);
         }else
         {
             d_xrefTitle->clear();
@@ -599,7 +788,7 @@ void Navigator::onSearchAtom()
     if( pname.isEmpty() )
         return;
     const char* atom = Lisp::Token::getSymbol(pname.toUtf8());
-    syncSelectedAtom(atom, Lisp::RowCol());
+    syncSelectedAtom(atom, Lisp::NoPos);
 }
 
 void Navigator::onSelectAtom()
@@ -607,88 +796,54 @@ void Navigator::onSelectAtom()
     QStringList l;
     QByteArrayList raw = Lisp::Token::getAllSymbols();
     foreach( const QByteArray& a, raw)
-        l << decode(a);
+        l << Lisp::Project::decode(a);
     l.sort(Qt::CaseInsensitive);
     const QString pname = QInputDialog::getItem(this, "Select Atom", "Select an atom from the list:", l );
     if( pname.isEmpty() )
         return;
     const char* atom = Lisp::Token::getSymbol(pname.toUtf8());
-    syncSelectedAtom(atom, Lisp::RowCol());
+    syncSelectedAtom(atom, Lisp::NoPos);
 }
 
 void Navigator::onAtomDblClicked(QListWidgetItem* item)
 {
     const char* atom = item->data(Qt::UserRole).toByteArray().constData();
-    syncSelectedAtom(atom, Lisp::RowCol());
+    syncSelectedAtom(atom, Lisp::NoPos);
 }
 
 void Navigator::onRunParser()
 {
-    QElapsedTimer t;
-    t.start();
     QApplication::setOverrideCursor(Qt::WaitCursor);
 
-    foreach( const QString& f, sourceFiles)
+    // roots added since the last run; the atoms already known are not interned again
+    QList<Lisp::Project*> parsed;
+    QList<qint64> times;
+    foreach( Lisp::Project* prj, prjs )
     {
-        QFile in(f);
-        QFileInfo info(f);
-        if( !in.open(QFile::ReadOnly) )
+        if( prj->asts.isEmpty() && !prj->sourceFiles.isEmpty() )
         {
-            qCritical() << "cannot open file for reading" << info.baseName();
-            continue;
-        }
-        Lisp::Reader r;
-        qDebug() << "*** parsing" << info.baseName();
-        if( !r.read(&in, f) )
-        {
-            qCritical() << "ERROR " << info.baseName() << r.getPos().row << r.getError();
-        }
-        // else
-        {
-            Lisp::Reader::Object ast = r.getAst();
-            asts.insert(f, ast);
-
-            Lisp::Reader::Xref::const_iterator i;
-            for( i = r.getXref().begin(); i != r.getXref().end(); ++i )
-                xref[i.key()][f].append(i.value() );
-
-            Lisp::Reader::Atoms::const_iterator j;
-            for( j = r.getAtoms().begin(); j != r.getAtoms().end(); ++j )
-            {
-                Lisp::Reader::Atom& a = atoms[j.key()];
-                a.props.unite(j.value().props);
-#if 0
-                qDebug() << "**** atom" << j.key() << "properties";
-                for( Lisp::Reader::Properties::const_iterator k = a.props.begin(); k != a.props.end(); ++k )
-                    qDebug() << "  " << k.key() << "=" << k.value().toString();
-#endif
-            }
-
-#if 0
-            QTextStream out;
-            QFile file(f + ".dump");
-            if( file.open(QFile::WriteOnly) )
-            {
-                out.setDevice(&file);
-                ast.print(out);
-            }
-#endif
-#if 0
-            QFile file(f + ".lisp");
-            if( file.open(QFile::WriteOnly) )
-            {
-                in.reset();
-                QString code = decode(in.readAll());
-                file.write( code.toUtf8() );
-            }
-#endif
+            QElapsedTimer t;
+            t.start();
+            prj->parse();
+            parsed << prj;
+            times << t.elapsed();
         }
     }
 
     QApplication::restoreOverrideCursor();
-    qDebug() << "parsed" << sourceFiles.size() << "files in" << t.elapsed() << "[ms]";
+    for( int i = 0; i < parsed.size(); i++ )
+    {
+        Lisp::Project* prj = parsed[i];
+        qDebug() << "parsed" << prj->sourceFiles.size() << "files of" << prj->root << "in" << times[i] << "[ms]";
+        foreach( const QString& line, prj->memoryReport(5) )
+            logMessage("INF: " + line);
+    }
+    if( parsed.isEmpty() )
+        return;
 
+    Lisp::Trace::Span span("fillAtomList");
     fillAtomList();
+    fillPropertyIndex();
 }
 
 void Navigator::onOpen()
@@ -696,12 +851,150 @@ void Navigator::onOpen()
     QString path = QFileDialog::getExistingDirectory(this,tr("Open Project Directory"),QDir::currentPath() );
     if( path.isEmpty() )
         return;
-    load(path);
+    load(QStringList() << path);
+}
+
+void Navigator::onAddRoot()
+{
+    QString path = QFileDialog::getExistingDirectory(this,tr("Add Root Directory"),QDir::currentPath() );
+    if( path.isEmpty() )
+        return;
+    foreach( Lisp::Project* p, prjs )
+    {
+        if( p->root == path )
+            return;
+    }
+    QStringList roots;
+    foreach( Lisp::Project* p, prjs )
+        roots << p->root;
+    setWindowTitle(QString("%1 - Interlisp Navigator %2").arg((roots << path).join(", "))
+                   .arg(QApplication::applicationVersion()));
+    addRoot(path);
+}
+
+void Navigator::onSaveTrace()
+{
+    if( !Lisp::Trace::isEnabled() )
+    {
+        Lisp::Trace::setEnabled(true);
+        logMessage(tr("INF: tracing enabled; reopen the project to trace loading, CTRL+SHIFT+T again to save"));
+        return;
+    }
+    const QString path = QFileDialog::getSaveFileName(this, tr("Save Chrome Trace"), QDir::currentPath(),
+                                                      tr("Trace Event JSON (*.json)"));
+    if( path.isEmpty() )
+        return;
+    if( Lisp::Trace::save(path) )
+        qDebug() << "saved" << Lisp::Trace::count() << "trace events to" << path;
+    else
+        qCritical() << "cannot write trace to" << path;
+}
+
+void Navigator::onCallsDblClicked(QTreeWidgetItem* item, int)
+{
+    const QByteArray atom = item->data(0, Qt::UserRole).toByteArray();
+    if( !atom.isEmpty() )
+        syncSelectedAtom(Lisp::Token::getSymbol(atom), Lisp::NoPos);
+}
+
+void Navigator::onTransitiveCalls()
+{
+    if( !d_callsAtom.isEmpty() )
+        fillCallGraph(Lisp::Token::getSymbol(d_callsAtom));
+}
+
+void Navigator::onHoldersExpanded(QTreeWidgetItem* item)
+{
+    // the atoms of a property are only listed when it is expanded the first time
+    if( item->parent() != 0 || item->childCount() != 0 )
+        return;
+    const quint32 prop = item->data(0, Qt::UserRole).toUInt();
+    foreach( Lisp::Project* prj, prjs )
+    {
+        if( int(prop) >= prj->holders.size() )
+            continue;
+        const Lisp::Project::Holders& h = prj->holders[prop];
+        Lisp::Project::Holders::const_iterator i;
+        for( i = h.begin(); i != h.end(); ++i )
+        {
+            const char* atom = Lisp::Token::getSymbolById(i.key());
+            QTreeWidgetItem* sub = new QTreeWidgetItem(item);
+            sub->setText(0, Lisp::Project::decode(atom));
+            sub->setData(0, Qt::UserRole, QVariant::fromValue(toBa(atom)));
+            sub->setText(1, displayName(i.value().file));
+            sub->setToolTip(1, i.value().file);
+            sub->setData(1, Qt::UserRole, i.value().file);
+            sub->setData(1, Qt::UserRole + 1, i.value().pos);
+        }
+    }
+    item->sortChildren(0, Qt::AscendingOrder);
+}
+
+void Navigator::onHoldersDblClicked(QTreeWidgetItem* item, int)
+{
+    if( item->parent() == 0 )
+        return;
+    const QByteArray atom = item->data(0, Qt::UserRole).toByteArray();
+    const QString file = item->data(1, Qt::UserRole).toString();
+    const quint32 pos = item->data(1, Qt::UserRole + 1).toUInt();
+    showFile(file, pos); // the atom in the form which sets the property
+    syncSelectedAtom(Lisp::Token::getSymbol(atom), pos);
+}
+
+void Navigator::onRunQuery()
+{
+    d_queryResults->clear();
+    // the workers of a running query read the pattern which compile replaces
+    d_query.cancel();
+    d_query.wait();
+    d_query.takeMatches();
+    if( !d_query.compile(d_queryEdit->text()) )
+    {
+        d_queryTitle->setText(tr("Error: %1").arg(d_query.getError()));
+        return;
+    }
+    d_queryTitle->setText(tr("searching..."));
+    d_queryClock.start();
+    d_query.start(prjs);
+    d_queryTimer->start();
+}
+
+void Navigator::onQueryPoll()
+{
+    // the matches found by the worker threads so far are appended to the list
+    const bool done = d_query.isDone();
+    const QList<Lisp::Query::Match> matches = d_query.takeMatches();
+    foreach( const Lisp::Query::Match& m, matches )
+    {
+        QTreeWidgetItem* item = new QTreeWidgetItem(d_queryResults);
+        const Lisp::Project* prj = projectOf(m.file);
+        const Lisp::RowCol rc = prj ? prj->lines.value(m.file).rowCol(m.pos) : Lisp::RowCol();
+        item->setText(0, QString("%1 (%2:%3)").arg(displayName(m.file)).arg(rc.row).arg(rc.col));
+        item->setText(1, Lisp::Project::decode(m.text));
+        item->setToolTip(1, item->text(1));
+        QStringList caps;
+        for( int i = 0; i < m.captures.size(); i++ )
+            caps << Lisp::Project::decode(m.captures[i].first + "=" + m.captures[i].second);
+        item->setText(2, caps.join(" "));
+        item->setData(0, Qt::UserRole, m.file);
+        item->setData(1, Qt::UserRole, m.pos);
+    }
+    if( done )
+    {
+        d_queryTimer->stop();
+        d_queryTitle->setText(tr("%1 matches in %2 ms").arg(d_query.getMatchCount()).arg(d_queryClock.elapsed()));
+    }else
+        d_queryTitle->setText(tr("searching... %1 matches").arg(d_query.getMatchCount()));
+}
+
+void Navigator::onQueryDblClicked(QTreeWidgetItem* item, int)
+{
+    showFile(item->data(0, Qt::UserRole).toString(), item->data(1, Qt::UserRole).toUInt());
 }
 
 void Navigator::onPropertiesDblClicked(QTreeWidgetItem* item, int)
 {
-    syncSelectedAtom(item->data(0, Qt::UserRole).toByteArray().constData(), Lisp::RowCol());
+    syncSelectedAtom(item->data(0, Qt::UserRole).toByteArray().constData(), Lisp::NoPos);
 }
 
 void Navigator::pushLocation(const Navigator::Location& loc)
@@ -716,20 +1009,26 @@ void Navigator::pushLocation(const Navigator::Location& loc)
 
 void Navigator::showFile(const QString& file)
 {
-    QFile f(file);
     viewer->d_list = 0;
+    if( viewer->showCached(file) )
+    {
+        title->setText(displayName(file));
+        return;
+    }
+    QFile f(file);
     if( !f.open(QIODevice::ReadOnly) )
     {
-        viewer->setPlainText(tr("; cannot open file %1").arg(f.fileName()));
+        viewer->showMessage(tr("; cannot open file %1").arg(f.fileName()));
         title->clear();
         return;
     }
-    title->setText(debang(f.fileName().mid(root.size()+1)));
-    const QString text = decode(f.readAll());
-    viewer->loadFromString(text, file);
+    title->setText(displayName(f.fileName()));
+    Lisp::Trace::Span span("load document", file, Lisp::Trace::Span::FileName);
+    const QString text = Lisp::Project::decode(f.readAll());
+    viewer->loadDocument(text, file);
 }
 
-void Navigator::showFile(const QString& file, const Lisp::RowCol& pos)
+void Navigator::showFile(const QString& file, quint32 pos)
 {
     showFile(file);
     if( !file.isEmpty() )
@@ -738,10 +1037,13 @@ void Navigator::showFile(const QString& file, const Lisp::RowCol& pos)
 
 void Navigator::openGenerated(const QString& file)
 {
+    Lisp::Project* prj = projectOf(file);
+    if( prj == 0 )
+        return;
     Navigator::Viewer* v = new Navigator::Viewer(0);
     v->d_ide = this;
     v->setAttribute(Qt::WA_DeleteOnClose);
-    Lisp::Reader::Object obj = asts.value(file);
+    Lisp::Reader::Object obj = prj->asts.value(file);
     QString code;
     QTextStream out(&code);
     obj.print(out);
@@ -750,17 +1052,67 @@ void Navigator::openGenerated(const QString& file)
     v->showMaximized();
 }
 
-void Navigator::showPosition(const Lisp::RowCol& pos)
+void Navigator::showPosition(quint32 pos)
 {
-    if( pos.row > 0 && pos.col > 0 )
+    if( pos == Lisp::NoPos )
+        return;
+    const QTextBlock b = viewer->document()->findBlock(pos);
+    if( b.isValid() )
+        viewer->setCursorPosition( b.blockNumber(), pos - b.position(), true );
+}
+
+bool Navigator::showDefinition(const char* atom, const QString& file, quint32 pos)
+{
+    // the root of file is searched first; false if there is no definition or pos is one
+    const quint32 id = Lisp::Token::getSymbolId(atom);
+    QList<Lisp::Project*> order;
+    Lisp::Project* cur = projectOf(file);
+    if( cur )
+        order << cur;
+    foreach( Lisp::Project* p, prjs )
     {
-        viewer->setCursorPosition( pos.row-1, pos.col-1, true );
+        if( p != cur )
+            order << p;
     }
+    foreach( Lisp::Project* p, order )
+    {
+        const Usage defs = p->defs.value(id);
+        if( defs.isEmpty() )
+            continue;
+        // prefer the function definition, then the one in the same file
+        QString bestFile;
+        Lisp::Reader::Ref best;
+        int bestScore = -1, count = 0;
+        Usage::const_iterator i;
+        for( i = defs.begin(); i != defs.end(); ++i )
+        {
+            foreach( const Lisp::Reader::Ref& r, i.value() )
+            {
+                if( i.key() == file && r.pos == pos )
+                    return false;
+                const int score = ( r.role == Lisp::Reader::Ref::Func ? 2 : 0 ) + ( i.key() == file ? 1 : 0 );
+                if( score > bestScore )
+                {
+                    bestScore = score;
+                    bestFile = i.key();
+                    best = r;
+                }
+                count++;
+            }
+        }
+        if( count > 1 )
+            logMessage(tr("INF: %1 is defined %2 times, see the xref").arg(Lisp::Project::decode(atom)).arg(count));
+        showFile(bestFile, best.pos);
+        return true;
+    }
+    return false;
 }
 
 void Navigator::showFile(const Navigator::Location& loc)
 {
-    showFile(loc.d_file, Lisp::RowCol(loc.d_line+1, loc.d_col+1) );
+    showFile(loc.d_file);
+    if( !loc.d_file.isEmpty() )
+        viewer->setCursorPosition( loc.d_line, loc.d_col, true );
     viewer->verticalScrollBar()->setValue(loc.d_yoff);
 }
 
@@ -860,6 +1212,85 @@ void Navigator::createProperties()
     connect(properties, SIGNAL(itemDoubleClicked(QTreeWidgetItem*,int)), this, SLOT(onPropertiesDblClicked(QTreeWidgetItem*,int)) );
 }
 
+void Navigator::createCallGraph()
+{
+    QDockWidget* dock = new QDockWidget( tr("Call Graph"), this );
+    dock->setObjectName("CallGraph");
+    dock->setAllowedAreas( Qt::AllDockWidgetAreas );
+    dock->setFeatures( QDockWidget::DockWidgetMovable | QDockWidget::DockWidgetClosable );
+    QWidget* pane = new QWidget(dock);
+    QVBoxLayout* vbox = new QVBoxLayout(pane);
+    vbox->setMargin(0);
+    vbox->setSpacing(0);
+    d_callsTitle = new QLabel(pane);
+    d_callsTitle->setMargin(2);
+    d_callsTitle->setWordWrap(true);
+    vbox->addWidget(d_callsTitle);
+    d_transitive = new QCheckBox(tr("transitive"), pane);
+    vbox->addWidget(d_transitive);
+    d_calls = new QTreeWidget(pane);
+    d_calls->setAlternatingRowColors(true);
+    d_calls->setHeaderHidden(true);
+    d_calls->setAllColumnsShowFocus(true);
+    d_calls->setRootIsDecorated(true);
+    vbox->addWidget(d_calls);
+    dock->setWidget(pane);
+    addDockWidget( Qt::RightDockWidgetArea, dock );
+    connect(d_calls, SIGNAL(itemDoubleClicked(QTreeWidgetItem*,int)), this, SLOT(onCallsDblClicked(QTreeWidgetItem*,int)) );
+    connect(d_transitive, SIGNAL(toggled(bool)), this, SLOT(onTransitiveCalls()) );
+}
+
+void Navigator::createPropertyIndex()
+{
+    QDockWidget* dock = new QDockWidget( tr("Property Index"), this );
+    dock->setObjectName("PropertyIndex");
+    dock->setAllowedAreas( Qt::AllDockWidgetAreas );
+    dock->setFeatures( QDockWidget::DockWidgetMovable | QDockWidget::DockWidgetClosable );
+    d_holders = new QTreeWidget(dock);
+    d_holders->setAlternatingRowColors(true);
+    d_holders->setHeaderLabels(QStringList() << "Property / Atom" << "Atoms / File");
+    d_holders->setAllColumnsShowFocus(true);
+    d_holders->setRootIsDecorated(true);
+    d_holders->setColumnCount(2);
+    dock->setWidget(d_holders);
+    addDockWidget( Qt::LeftDockWidgetArea, dock );
+    connect(d_holders, SIGNAL(itemExpanded(QTreeWidgetItem*)), this, SLOT(onHoldersExpanded(QTreeWidgetItem*)) );
+    connect(d_holders, SIGNAL(itemDoubleClicked(QTreeWidgetItem*,int)), this, SLOT(onHoldersDblClicked(QTreeWidgetItem*,int)) );
+}
+
+void Navigator::createQuery()
+{
+    QDockWidget* dock = new QDockWidget( tr("Query"), this );
+    dock->setObjectName("Query");
+    dock->setAllowedAreas( Qt::AllDockWidgetAreas );
+    dock->setFeatures( QDockWidget::DockWidgetMovable | QDockWidget::DockWidgetClosable );
+    QWidget* pane = new QWidget(dock);
+    QVBoxLayout* vbox = new QVBoxLayout(pane);
+    vbox->setMargin(0);
+    vbox->setSpacing(0);
+    d_queryEdit = new QLineEdit(pane);
+    d_queryEdit->setPlaceholderText(tr("pattern, e.g. (BITBLT *)#>10 or (PUTPROPS ? * MACRO *)"));
+    vbox->addWidget(d_queryEdit);
+    d_queryTitle = new QLabel(pane);
+    d_queryTitle->setMargin(2);
+    d_queryTitle->setWordWrap(true);
+    vbox->addWidget(d_queryTitle);
+    d_queryResults = new QTreeWidget(pane);
+    d_queryResults->setAlternatingRowColors(true);
+    d_queryResults->setHeaderLabels(QStringList() << "File" << "Form" << "Captures");
+    d_queryResults->setAllColumnsShowFocus(true);
+    d_queryResults->setRootIsDecorated(false);
+    d_queryResults->setColumnCount(3);
+    vbox->addWidget(d_queryResults);
+    dock->setWidget(pane);
+    addDockWidget( Qt::BottomDockWidgetArea, dock );
+    d_queryTimer = new QTimer(this);
+    d_queryTimer->setInterval(100);
+    connect(d_queryTimer, SIGNAL(timeout()), this, SLOT(onQueryPoll()) );
+    connect(d_queryEdit, SIGNAL(returnPressed()), this, SLOT(onRunQuery()) );
+    connect(d_queryResults, SIGNAL(itemDoubleClicked(QTreeWidgetItem*,int)), this, SLOT(onQueryDblClicked(QTreeWidgetItem*,int)) );
+}
+
 void Navigator::closeEvent(QCloseEvent* event)
 {
     QSettings s;
@@ -869,7 +1300,7 @@ void Navigator::closeEvent(QCloseEvent* event)
 
 static bool sortExList( const Lisp::Reader::Ref& lhs, const Lisp::Reader::Ref& rhs )
 {
-    return lhs.pos.row < rhs.pos.row || (!(rhs.pos.row < lhs.pos.row) && lhs.pos.col < rhs.pos.col);
+    return lhs.pos < rhs.pos;
 }
 
 static inline QString roleToStr(quint8 r)
@@ -886,49 +1317,107 @@ static inline QString roleToStr(quint8 r)
         return "param";
     case Lisp::Reader::Ref::Lhs:
         return "lhs";
+    case Lisp::Reader::Ref::Bound:
+        return "bound";
     default:
         return "";
     }
 }
 
-void Navigator::fillXrefForAtom(const char* atom, const Lisp::RowCol& rc)
+void Navigator::fillXrefForAtom(const char* atom, quint32 pos)
 {
     d_xref->clear();
-
-    QHash<QString,Lisp::Reader::Refs> usage = xref.value(atom);
+    d_xref->setRootIsDecorated(prjs.size() > 1);
 
     QFont f = d_xref->font();
     f.setBold(true);
 
-    d_xrefTitle->setText(tr("Atom %1").arg(decode(atom)));
     const QString curMod = viewer->getPath();
+    const quint32 id = Lisp::Token::getSymbolId(atom);
+
+    // a bound or declaring occurrence restricts the list to its scope, a free one hides the local ones
+    Lisp::Project* cur = projectOf(curMod);
+    const Lisp::Reader::Scoping curScoping = cur ? cur->scoping.value(curMod) : Lisp::Reader::Scoping();
+    quint32 decl = Lisp::Reader::declarationOf(curScoping, pos);
+    if( cur && pos != Lisp::NoPos && decl == Lisp::NoPos )
+    {
+        foreach( const Lisp::Reader::Ref& r, cur->xref.value(id).value(curMod) )
+        {
+            if( r.pos == pos && ( r.role == Lisp::Reader::Ref::Param || r.role == Lisp::Reader::Ref::Local ) )
+                decl = pos;
+        }
+    }
+    int hidden = 0;
 
     QTreeWidgetItem* black = 0;
-    QHash<QString,Lisp::Reader::Refs>::const_iterator i;
-    for( i = usage.begin(); i != usage.end(); ++i )
+    foreach( Lisp::Project* prj, prjs )
     {
-        Lisp::Reader::Refs refs = i.value();
-        std::sort( refs.begin(), refs.end(), sortExList );
-        const QString modName = debang(QFileInfo(i.key()).baseName());
-        foreach( const Lisp::Reader::Ref& s, refs )
+        // with several roots the usages are grouped by root, so they can be compared side by side
+        QTreeWidgetItem* top = 0;
+        if( prjs.size() > 1 )
         {
-            QTreeWidgetItem* item = new QTreeWidgetItem(d_xref);
-            item->setText( 0, QString("%1 (%2:%3 %4)")
-                        .arg(modName)
-                        .arg(s.pos.row).arg(s.pos.col)
-                        .arg( roleToStr(s.role) ));
-            if( curMod == i.key() && s.pos == rc )
+            top = new QTreeWidgetItem(d_xref);
+            top->setFont(0,f);
+        }
+        const Usage usage = prj->xref.value(id);
+        int count = 0;
+        Usage::const_iterator i;
+        for( i = usage.begin(); i != usage.end(); ++i )
+        {
+            if( decl != Lisp::NoPos && ( prj != cur || i.key() != curMod ) )
+                continue;
+            const Lisp::Reader::Scoping scoping = prj->scoping.value(i.key());
+            Lisp::Reader::Refs refs;
+            foreach( const Lisp::Reader::Ref& r, i.value() )
             {
-                item->setFont(0,f);
-                black = item;
+                if( decl != Lisp::NoPos )
+                {
+                    if( r.pos == decl || Lisp::Reader::declarationOf(scoping, r.pos) == decl )
+                        refs << r;
+                }else if( r.role == Lisp::Reader::Ref::Param || r.role == Lisp::Reader::Ref::Local ||
+                          Lisp::Reader::declarationOf(scoping, r.pos) != Lisp::NoPos )
+                    hidden++;
+                else
+                    refs << r;
             }
-            item->setToolTip( 0, item->text(0) );
-            item->setData( 0, Qt::UserRole, QVariant::fromValue( s ) );
-            item->setData( 1, Qt::UserRole, QVariant::fromValue( i.key()) );
-            if( i.key() != curMod )
-                item->setForeground( 0, Qt::gray );
+            if( refs.isEmpty() )
+                continue;
+            std::sort( refs.begin(), refs.end(), sortExList );
+            count += refs.size();
+            const QString modName = Lisp::Project::debang(QFileInfo(i.key()).baseName());
+            const Lisp::LineTable lt = prj->lines.value(i.key());
+            foreach( const Lisp::Reader::Ref& s, refs )
+            {
+                QTreeWidgetItem* item = top ? new QTreeWidgetItem(top) : new QTreeWidgetItem(d_xref);
+                const Lisp::RowCol rc = lt.rowCol(s.pos);
+                item->setText( 0, QString("%1 (%2:%3 %4)")
+                            .arg(modName)
+                            .arg(rc.row).arg(rc.col)
+                            .arg( roleToStr(s.role) ));
+                if( curMod == i.key() && s.pos == pos )
+                {
+                    item->setFont(0,f);
+                    black = item;
+                }
+                item->setToolTip( 0, item->text(0) );
+                item->setData( 0, Qt::UserRole, QVariant::fromValue( s ) );
+                item->setData( 1, Qt::UserRole, QVariant::fromValue( i.key()) );
+                if( i.key() != curMod )
+                    item->setForeground( 0, Qt::gray );
+            }
+        }
+        if( top )
+        {
+            top->setText(0, tr("%1 (%2)").arg(QFileInfo(prj->root).fileName()).arg(count));
+            top->setExpanded(true);
         }
     }
+    if( decl != Lisp::NoPos )
+        d_xrefTitle->setText(tr("Local %1").arg(Lisp::Project::decode(atom)));
+    else if( hidden )
+        d_xrefTitle->setText(tr("Atom %1 (%2 local occurrences not shown)").arg(Lisp::Project::decode(atom)).arg(hidden));
+    else
+        d_xrefTitle->setText(tr("Atom %1").arg(Lisp::Project::decode(atom)));
     if( black && !d_lock3 )
     {
         d_xref->scrollToItem(black, QAbstractItemView::PositionAtCenter);
@@ -936,34 +1425,118 @@ void Navigator::fillXrefForAtom(const char* atom, const Lisp::RowCol& rc)
     }
 }
 
-static inline QByteArray toBa(const char* str)
-{
-    return QByteArray::fromRawData(str, strlen(str));
-}
-
 void Navigator::fillProperties(const char* atom)
 {
     properties->clear();
-    propTitle->setText(tr("Atom %1").arg(decode(atom)));
-    Lisp::Reader::Atoms::const_iterator i = atoms.find(atom);
-    if( i != atoms.end() )
+    propTitle->setText(tr("Atom %1").arg(Lisp::Project::decode(atom)));
+    // one value column per root
+    QStringList labels;
+    labels << "Key";
+    if( prjs.size() > 1 )
+    {
+        foreach( Lisp::Project* prj, prjs )
+            labels << QFileInfo(prj->root).fileName();
+    }else
+        labels << "Value";
+    properties->setColumnCount(labels.size());
+    properties->setHeaderLabels(labels);
+    const quint32 id = Lisp::Token::getSymbolId(atom);
+    QHash<const char*,QTreeWidgetItem*> items;
+    for( int r = 0; r < prjs.size(); r++ )
     {
+        if( int(id) >= prjs[r]->atoms.size() )
+            continue;
+        const Lisp::Reader::Properties& props = prjs[r]->atoms[id].props;
         Lisp::Reader::Properties::const_iterator j;
-        for(j = i.value().props.begin(); j != i.value().props.end(); ++j )
+        for(j = props.begin(); j != props.end(); ++j )
         {
             if( j.key() == 0 )
                 continue;
-            QTreeWidgetItem* item = new QTreeWidgetItem(properties);
-            item->setText(0, decode(j.key()));
-            item->setData(0, Qt::UserRole, QVariant::fromValue(toBa(j.key())));
-            const QString str = decode(j.value().toString(true));
-            item->setText(1, str);
-            item->setToolTip(1, str);
+            QTreeWidgetItem* item = items.value(j.key());
+            if( item == 0 )
+            {
+                item = new QTreeWidgetItem(properties);
+                item->setText(0, Lisp::Project::decode(j.key()));
+                item->setData(0, Qt::UserRole, QVariant::fromValue(toBa(j.key())));
+                items.insert(j.key(), item);
+            }
+            const QString str = Lisp::Project::decode(j.value().toString(true));
+            item->setText(r + 1, str);
+            item->setToolTip(r + 1, str);
         }
     }
     properties->sortByColumn(0);
 }
 
+static void fillCalls(QTreeWidgetItem* super, const QVector<quint32>& ids)
+{
+    foreach( quint32 id, ids )
+    {
+        const char* atom = Lisp::Token::getSymbolById(id);
+        QTreeWidgetItem* item = new QTreeWidgetItem(super);
+        item->setText(0, Lisp::Project::decode(atom));
+        item->setData(0, Qt::UserRole, QVariant::fromValue(toBa(atom)));
+    }
+    super->sortChildren(0, Qt::AscendingOrder);
+}
+
+void Navigator::fillCallGraph(const char* atom)
+{
+    d_calls->clear();
+    d_callsAtom = toBa(atom);
+    d_callsTitle->setText(tr("Atom %1").arg(Lisp::Project::decode(atom)));
+    const quint32 id = Lisp::Token::getSymbolId(atom);
+    const bool transitive = d_transitive->isChecked();
+    foreach( Lisp::Project* prj, prjs )
+    {
+        const QString root = prjs.size() > 1 ? QFileInfo(prj->root).fileName() + ": " : QString();
+        QVector<quint32> callees, callers;
+        if( transitive )
+        {
+            callees = Lisp::CallGraph::toIds(prj->calls.reach(id));
+            callers = Lisp::CallGraph::toIds(prj->calls.reach(id, true));
+        }else
+        {
+            callees = prj->calls.callees(id);
+            callers = prj->calls.callers(id);
+        }
+        QTreeWidgetItem* item = new QTreeWidgetItem(d_calls);
+        item->setText(0, tr("%1calls (%2)").arg(root).arg(callees.size()));
+        fillCalls(item, callees);
+        item->setExpanded(!transitive || callees.size() < 100);
+        item = new QTreeWidgetItem(d_calls);
+        item->setText(0, tr("%1called by (%2)").arg(root).arg(callers.size()));
+        fillCalls(item, callers);
+        item->setExpanded(!transitive || callers.size() < 100);
+    }
+}
+
+void Navigator::fillPropertyIndex()
+{
+    d_holders->clear();
+    // property name atom id -> the distinct atoms over all roots; an atom whose property is set
+    // in several files is one holder
+    QMap<quint32,QSet<quint32> > counts;
+    foreach( Lisp::Project* prj, prjs )
+    {
+        for( int i = 0; i < prj->holders.size(); i++ )
+        {
+            if( !prj->holders[i].isEmpty() )
+                counts[i].unite(prj->holders[i].uniqueKeys().toSet());
+        }
+    }
+    QMap<quint32,QSet<quint32> >::const_iterator j;
+    for( j = counts.begin(); j != counts.end(); ++j )
+    {
+        QTreeWidgetItem* item = new QTreeWidgetItem(d_holders);
+        item->setText(0, Lisp::Project::decode(Lisp::Token::getSymbolById(j.key())));
+        item->setText(1, QString::number(j.value().size()));
+        item->setData(0, Qt::UserRole, j.key());
+        item->setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+    }
+    d_holders->sortByColumn(0, Qt::AscendingOrder);
+}
+
 void Navigator::fillAtomList()
 {
     atomList->clear();
@@ -971,43 +1544,50 @@ void Navigator::fillAtomList()
     foreach( const QByteArray& a, raw)
     {
         QListWidgetItem* item = new QListWidgetItem(atomList);
-        item->setText(decode(a));
+        item->setText(Lisp::Project::decode(a));
         item->setData(Qt::UserRole, QVariant::fromValue(a));
     }
     atomList->sortItems();
 }
 
-void Navigator::syncSelectedAtom(const char* atom, const Lisp::RowCol& rc)
+void Navigator::syncSelectedAtom(const char* atom, quint32 pos)
 {
-    fillXrefForAtom(atom, rc);
+    fillXrefForAtom(atom, pos);
     //TODO syncModView(hit->decl);
 
-    QHash<QString,Lisp::Reader::Refs> usage = xref.value(atom);
-    viewer->markNonTerms(usage.value(viewer->getPath()));
+    Lisp::Project* prj = projectOf(viewer->getPath());
+    if( prj )
+        viewer->markNonTerms(prj->xref.value(Lisp::Token::getSymbolId(atom)).value(viewer->getPath()));
+    else
+        viewer->markNonTerms(Lisp::Reader::Refs());
 
     fillProperties(atom);
+    fillCallGraph(atom);
 }
 
-QPair<Lisp::Reader::List*, int> Navigator::findSymbolBySourcePos(const QString& file, quint32 line, quint16 col)
+QPair<Lisp::Reader::List*, int> Navigator::findSymbolBySourcePos(const QString& file, quint32 pos)
 {
-    Lisp::Reader::Object obj = asts.value(file);
+    Lisp::Project* prj = projectOf(file);
+    if( prj == 0 )
+        return qMakePair((Lisp::Reader::List*)0,-1);
+    Lisp::Reader::Object obj = prj->asts.value(file);
     if( obj.type() != Lisp::Reader::Object::List_)
         return qMakePair((Lisp::Reader::List*)0,-1);
     Lisp::Reader::List* l = obj.getList();
-    return findSymbolBySourcePos(l, line, col);
+    return findSymbolBySourcePos(l, pos);
 }
 
-QPair<Lisp::Reader::List*, int> Navigator::findSymbolBySourcePos(Lisp::Reader::List* l, quint32 line, quint16 col)
+QPair<Lisp::Reader::List*, int> Navigator::findSymbolBySourcePos(Lisp::Reader::List* l, quint32 pos)
 {
     Q_ASSERT(l);
     for( int i = 0; i < l->list.size(); i++ )
     {
         Q_ASSERT( i < l->elementPositions.size() );
-        Lisp::RowCol r = l->elementPositions[i];
+        const quint32 r = l->elementPositions[i];
 
 #if 0
         const QByteArray string = l->list[i].toString();
-        qDebug() << "element" << i << "at" << r.row << r.col << string.left(40);
+        qDebug() << "element" << i << "at" << r << string.left(40);
 #endif
 
         switch( l->list[i].type() )
@@ -1018,16 +1598,13 @@ QPair<Lisp::Reader::List*, int> Navigator::findSymbolBySourcePos(Lisp::Reader::L
             // we're not interested in these objects
             break;
         case Lisp::Reader::Object::Atom_:
-            if( line == r.row && col >= r.col && col <= r.col + l->list[i].getAtomLen(true) )
+            if( pos >= r && pos <= r + l->list[i].getAtomLen(true) )
                 return qMakePair(l,i);
             break;
         case Lisp::Reader::Object::List_: {
-                const Lisp::RowCol end = l->list[i].getList()->end;
-                if( (line > r.row && line < end.row) ||
-                        ( line == r.row && r.row == end.row && col >= r.col && col <= end.col) ||
-                        (line == r.row && r.row != end.row && col >= r.col) ||
-                        (line == end.row && r.row != end.row && col <= end.col) )
-                    return findSymbolBySourcePos(l->list[i].getList(), line, col);
+                const quint32 end = l->list[i].getList()->end;
+                if( pos >= r && pos <= end )
+                    return findSymbolBySourcePos(l->list[i].getList(), pos);
                 break;
             }
         default:
@@ -1037,8 +1614,205 @@ QPair<Lisp::Reader::List*, int> Navigator::findSymbolBySourcePos(Lisp::Reader::L
     return qMakePair(l, -1);
 }
 
+static void printReach(QTextStream& out, const Lisp::Project& prj, const QByteArray& name)
+{
+    // e.g. what a bootstrap VM has to implement before it can run the given function
+    const quint32 id = Lisp::Token::getSymbolId(Lisp::Token::getSymbol(name));
+    QElapsedTimer t;
+    t.start();
+    const QVector<quint32> callees = Lisp::CallGraph::toIds(prj.calls.reach(id));
+    const QVector<quint32> callers = Lisp::CallGraph::toIds(prj.calls.reach(id, true));
+    out << name << " eventually calls " << callees.size() << " and is eventually called by "
+        << callers.size() << " functions or forms, found in " << t.nsecsElapsed() / 1000 << " [us]" << endl;
+    QStringList names;
+    foreach( quint32 callee, callees )
+        names << Lisp::Project::decode(Lisp::Token::getSymbolById(callee));
+    names.sort();
+    foreach( const QString& n, names )
+        out << "  " << n << endl;
+}
+
+static void printQuery(QTextStream& out, Lisp::Project& prj, const QString& pattern)
+{
+    Lisp::Query q;
+    if( !q.compile(pattern) )
+    {
+        qCritical() << "query error:" << q.getError();
+        return;
+    }
+    QElapsedTimer t;
+    t.start();
+    q.start(QList<Lisp::Project*>() << &prj);
+    q.wait();
+    const QList<Lisp::Query::Match> matches = q.takeMatches();
+    out << matches.size() << " matches of " << pattern << " found in " << t.elapsed() << " [ms]" << endl;
+    foreach( const Lisp::Query::Match& m, matches )
+    {
+        const Lisp::RowCol rc = prj.lines.value(m.file).rowCol(m.pos);
+        out << "  " << m.file << ":" << rc.row << ":" << rc.col << " " << Lisp::Project::decode(m.text);
+        for( int i = 0; i < m.captures.size(); i++ )
+            out << " " << Lisp::Project::decode(m.captures[i].first + "=" + m.captures[i].second);
+        out << endl;
+    }
+}
+
+static void printCode(QTextStream& out, const Lisp::Project& prj, const QByteArray& name)
+{
+    // shows what the bytecode compiler makes of a DEFINEQ function of the project
+    const quint32 id = Lisp::Token::getSymbolId(Lisp::Token::getSymbol(name));
+    const quint32 defineq = Lisp::Token::getSymbolId(Lisp::Token::getSymbol("DEFINEQ"));
+    QMap<QString,Lisp::Reader::Object>::const_iterator i;
+    for( i = prj.asts.begin(); i != prj.asts.end(); ++i )
+    {
+        if( i.value().type() != Lisp::Reader::Object::List_ )
+            continue;
+        const Lisp::Reader::List* top = i.value().getList();
+        for( int j = 0; j < top->list.size(); j++ )
+        {
+            if( top->list[j].type() != Lisp::Reader::Object::List_ ||
+                    top->list[j].getList()->list.isEmpty() ||
+                    top->list[j].getList()->list.first().getAtomId() != defineq )
+                continue;
+            const Lisp::Reader::List* form = top->list[j].getList();
+            for( int k = 1; k < form->list.size(); k++ )
+            {
+                if( form->list[k].type() != Lisp::Reader::Object::List_ )
+                    continue;
+                const Lisp::Reader::List* def = form->list[k].getList();
+                if( def->list.size() != 2 || def->list.first().getAtomId() != id )
+                    continue;
+                Lisp::Compiler c;
+                Lisp::Code* code = c.compile(id, def->list[1]);
+                if( code == 0 )
+                {
+                    out << name << " in " << i.key() << " cannot be compiled: " << c.getError() << endl;
+                    return;
+                }
+                out << i.key() << endl;
+                foreach( const QString& line, code->disassemble() )
+                    out << "  " << line << endl;
+                delete code;
+                return;
+            }
+        }
+    }
+    out << "no DEFINEQ function " << name << " found" << endl;
+}
+
+static int runBatch(const QStringList& roots, bool stats, bool cons, const QByteArray& reach,
+                    const QString& query, const QByteArray& disasm)
+{
+    // parses the source trees without GUI; the log goes to stderr
+    QTextStream out(stdout);
+    foreach( const QString& path, roots )
+    {
+        QElapsedTimer t;
+        t.start();
+        Lisp::Project prj;
+        prj.setHashConsing(cons); // the GUI needs the unshared lists with outer and element positions
+        prj.setRoot(path);
+        prj.parse();
+        out << "parsed " << prj.sourceFiles.size() << " files of " << path << " in " << t.elapsed()
+            << " [ms], " << Lisp::Token::getSymbolCount() << " atoms so far" << endl;
+        if( stats )
+        {
+            foreach( const QString& line, prj.memoryReport(20) )
+                out << line << endl;
+        }
+        if( !reach.isEmpty() )
+            printReach(out, prj, reach);
+        if( !query.isEmpty() )
+            printQuery(out, prj, query);
+        if( !disasm.isEmpty() )
+            printCode(out, prj, disasm);
+    }
+    return 0;
+}
+
+static int runDiff(const QString& lhsPath, const QString& rhsPath)
+{
+    // compares two source trees, e.g. two releases, without GUI
+    QElapsedTimer t;
+    t.start();
+    Lisp::Project lhs, rhs;
+    lhs.setRoot(lhsPath);
+    lhs.parse();
+    rhs.setRoot(rhsPath);
+    rhs.parse();
+    const qint64 parsed = t.elapsed();
+    Lisp::Diff diff;
+    diff.compare(lhs, rhs);
+    QTextStream out(stdout);
+    out << "parsed " << lhs.sourceFiles.size() << " and " << rhs.sourceFiles.size() << " files in "
+        << parsed << " [ms], compared in " << t.elapsed() - parsed << " [ms]" << endl;
+    foreach( const QString& line, diff.report() )
+        out << line << endl;
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
+    // InterlispNavigator [-batch [-stats] [-cons] [-reach atom] [-query pattern] [-disasm atom]] [-diff path path] [-bench] [-trace file.json] [path...]
+    bool batch = false, stats = false, cons = false, bench = false;
+    QStringList paths;
+    QString tracePath, diffPath, query;
+    QByteArray reach, disasm;
+    for( int i = 1; i < argc; i++ )
+    {
+        const QByteArray arg = argv[i];
+        if( arg == "-batch" )
+            batch = true;
+        else if( arg == "-stats" )
+            stats = true;
+        else if( arg == "-cons" )
+            cons = true;
+        else if( arg == "-reach" && i + 1 < argc )
+            reach = argv[++i];
+        else if( arg == "-disasm" && i + 1 < argc )
+            disasm = argv[++i];
+        else if( arg == "-query" && i + 1 < argc )
+            query = QString::fromLocal8Bit(argv[++i]);
+        else if( arg == "-bench" )
+            bench = true;
+        else if( arg == "-diff" && i + 1 < argc )
+            diffPath = QString::fromLocal8Bit(argv[++i]);
+        else if( arg == "-trace" && i + 1 < argc )
+            tracePath = QString::fromLocal8Bit(argv[++i]);
+        else
+            paths << QString::fromLocal8Bit(arg);
+    }
+    if( !tracePath.isEmpty() )
+        Lisp::Trace::setEnabled(true);
+
+    if( batch || bench || !diffPath.isEmpty() )
+    {
+        QCoreApplication a(argc, argv);
+        a.setOrganizationName("me@rochus-keller.ch");
+        a.setOrganizationDomain("github.com/rochus-keller/Interlisp");
+        a.setApplicationName("InterlispNavigator");
+        a.setApplicationVersion("0.3.9");
+        if( bench )
+        {
+            QTextStream out(stdout);
+            foreach( const QString& line, Lisp::Bench::run() )
+                out << line << endl;
+            if( !tracePath.isEmpty() && !Lisp::Trace::save(tracePath) )
+                qCritical() << "cannot write trace to" << tracePath;
+            return 0;
+        }
+        if( paths.isEmpty() || ( !diffPath.isEmpty() && paths.size() != 1 ) )
+        {
+            qCritical() << "usage: InterlispNavigator -batch [-stats] [-cons] [-reach atom] [-query pattern] [-disasm atom] [-trace file.json] path...";
+            qCritical() << "       InterlispNavigator -diff path [-trace file.json] path";
+            qCritical() << "       InterlispNavigator -bench [-trace file.json]";
+            return -1;
+        }
+        const int res = diffPath.isEmpty() ? runBatch(paths, stats, cons, reach, query, disasm) : runDiff(diffPath, paths.first());
+        if( !tracePath.isEmpty() && !Lisp::Trace::save(tracePath) )
+            qCritical() << "cannot write trace to" << tracePath;
+        return res;
+    }
+
     QApplication a(argc, argv);
     a.setOrganizationName("me@rochus-keller.ch");
     a.setOrganizationDomain("github.com/rochus-keller/Interlisp");
@@ -1056,11 +1830,13 @@ int main(int argc, char *argv[])
     Navigator w;
     w.setWindowTitle(QString("Interlisp Navigator %1").arg(QApplication::applicationVersion()));
     w.showMaximized();
-    if( a.arguments().size() > 1 )
+    if( !paths.isEmpty() )
     {
-        w.load(a.arguments()[1]);
+        w.load(paths);
     }
 
-    return a.exec();
+    const int res = a.exec();
+    if( !tracePath.isEmpty() && !Lisp::Trace::save(tracePath) )
+        qCritical() << "cannot write trace to" << tracePath;
+    return res;
 }
-
@@ -22,7 +22,9 @@
 // Adopted from the Lisa Pascal Navigator
 
 #include <QMainWindow>
-#include "LispReader.h"
+#include <QElapsedTimer>
+#include "LispProject.h"
+#include "LispQuery.h"
 
 class QTreeWidget;
 class QLabel;
@@ -31,6 +33,9 @@ class CodeEditor;
 class QPlainTextEdit;
 class QListWidget;
 class QListWidgetItem;
+class QCheckBox;
+class QLineEdit;
+class QTimer;
 
 class Navigator : public QMainWindow
 {
@@ -40,7 +45,7 @@ public:
     Navigator(QWidget *parent = 0);
     ~Navigator();
 
-    void load(const QString& path);
+    void load(const QStringList& roots); // e.g. several releases side by side
     void logMessage(const QString&);
 
 protected slots:
@@ -55,7 +60,16 @@ protected slots:
     void onAtomDblClicked(QListWidgetItem*);
     void onRunParser();
     void onOpen();
+    void onAddRoot();
     void onPropertiesDblClicked(QTreeWidgetItem*,int);
+    void onSaveTrace();
+    void onCallsDblClicked(QTreeWidgetItem*,int);
+    void onTransitiveCalls();
+    void onHoldersExpanded(QTreeWidgetItem*);
+    void onHoldersDblClicked(QTreeWidgetItem*,int);
+    void onRunQuery();
+    void onQueryPoll();
+    void onQueryDblClicked(QTreeWidgetItem*,int);
 
 protected:
     struct Location
@@ -71,22 +85,31 @@ protected:
     };
     void pushLocation( const Location& );
     void showFile(const QString& file);
-    void showFile(const QString& file, const Lisp::RowCol& pos);
+    void showFile(const QString& file, quint32 pos);
     void openGenerated(const QString& file);
-    void showPosition(const Lisp::RowCol& pos);
+    void showPosition(quint32 pos);
+    bool showDefinition(const char* atom, const QString& file, quint32 pos);
     void showFile(const Location& file);
+    void addRoot(const QString& path);
+    Lisp::Project* projectOf(const QString& file) const;
+    QString displayName(const QString& file) const;
     void createSourceTree();
     void createXref();
     void createLog();
     void createAtomList();
     void createProperties();
+    void createCallGraph();
+    void createPropertyIndex();
+    void createQuery();
     void closeEvent(QCloseEvent* event);
-    void fillXrefForAtom(const char* atom, const Lisp::RowCol& rc);
+    void fillXrefForAtom(const char* atom, quint32 pos);
     void fillProperties(const char* atom);
+    void fillCallGraph(const char* atom);
+    void fillPropertyIndex();
     void fillAtomList();
-    void syncSelectedAtom(const char* atom, const Lisp::RowCol& rc);
-    QPair<Lisp::Reader::List*,int> findSymbolBySourcePos(const QString& file, quint32 line, quint16 col);
-    QPair<Lisp::Reader::List*,int> findSymbolBySourcePos(Lisp::Reader::List*, quint32 line, quint16 col);
+    void syncSelectedAtom(const char* atom, quint32 pos);
+    QPair<Lisp::Reader::List*,int> findSymbolBySourcePos(const QString& file, quint32 pos);
+    QPair<Lisp::Reader::List*,int> findSymbolBySourcePos(Lisp::Reader::List*, quint32 pos);
 
 private:
     QTreeWidget* tree;
@@ -95,15 +118,23 @@ private:
     QTreeWidget* d_xref;
     QTreeWidget* properties;
     QLabel* propTitle;
+    QLabel* d_callsTitle;
+    QTreeWidget* d_calls;
+    QCheckBox* d_transitive;
+    QByteArray d_callsAtom;
+    QTreeWidget* d_holders;
+    QLabel* d_queryTitle;
+    QLineEdit* d_queryEdit;
+    QTreeWidget* d_queryResults;
+    QTimer* d_queryTimer;
+    QElapsedTimer d_queryClock;
+    Lisp::Query d_query;
     QPlainTextEdit* d_msgLog;
-    QStringList sourceFiles;
     QListWidget* atomList;
     class Viewer;
     Viewer* viewer;
-    QString root;
-    QMap<QString,Lisp::Reader::Object> asts;
-    QHash<const char*,QHash<QString,Lisp::Reader::Refs> > xref;
-    Lisp::Reader::Atoms atoms;
+    QList<Lisp::Project*> prjs; // one per root; all share the atoms of the process wide symbol table
+    typedef Lisp::Project::Usage Usage;
     QList<Location> d_backHisto; // d_backHisto.last() ist aktuell angezeigtes Objekt
     QList<Location> d_forwardHisto;
     bool d_pushBackLock, d_lock3;
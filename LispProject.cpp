@@ -0,0 +1,439 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include "LispProject.h"
+#include "LispLexer.h"
+#include "LispTrace.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QTextStream>
+#include <QtDebug>
+#include <ctype.h>
+#include <algorithm>
+using namespace Lisp;
+
+Project::Project():cons(0)
+{
+
+}
+
+Project::~Project()
+{
+    clear();
+    if( cons )
+        delete cons;
+}
+
+void Project::clear()
+{
+    root.clear();
+    sourceFiles.clear();
+    asts.clear();
+    lines.clear();
+    scoping.clear();
+    positions.clear();
+    xref.clear();
+    defs.clear();
+    atoms.clear();
+    holders.clear();
+    calls.clear();
+    if( cons )
+        cons->clear();
+}
+
+void Project::setHashConsing(bool on)
+{
+    if( on && cons == 0 )
+        cons = new Reader::ConsTable();
+    else if( !on && cons )
+    {
+        delete cons;
+        cons = 0;
+    }
+}
+
+void Project::setRoot(const QString& path)
+{
+    clear();
+    root = path;
+    Trace::Span span("collectFiles", path);
+    sourceFiles = collectFiles(path);
+}
+
+void Project::parse()
+{
+    Trace::Span all("parse");
+    Reader::Calls edges;
+    foreach( const QString& f, sourceFiles)
+    {
+        QFile in(f);
+        QFileInfo info(f);
+        if( !in.open(QFile::ReadOnly) )
+        {
+            qCritical() << "cannot open file for reading" << info.baseName();
+            continue;
+        }
+        Trace::Span file("file", f, Trace::Span::FileName);
+        Reader r;
+        r.setConsTable(cons);
+        qDebug() << "*** parsing" << info.baseName();
+        bool ok;
+        {
+            Trace::Span span("read", f, Trace::Span::FileName);
+            ok = r.read(&in, f);
+        }
+        if( !ok )
+        {
+            qCritical() << "ERROR " << info.baseName() << r.getLines().rowCol(r.getPos()).row << r.getError();
+        }
+        // else
+        {
+            Reader::Object ast = r.getAst();
+            asts.insert(f, ast);
+            lines.insert(f, r.getLines());
+            scoping.insert(f, r.getScoping());
+            if( cons )
+                positions.insert(f, r.getPositions());
+
+            const int count = Token::getSymbolCount();
+            if( xref.size() < count )
+            {
+                xref.resize(count);
+                defs.resize(count);
+                atoms.resize(count);
+                holders.resize(count);
+            }
+
+            {
+                Trace::Span span("merge xref", f, Trace::Span::FileName);
+                Reader::Xref::const_iterator i;
+                for( i = r.getXref().begin(); i != r.getXref().end(); ++i )
+                    xref[Token::getSymbolId(i.key())][f].append(i.value() );
+                for( i = r.getDefinitions().begin(); i != r.getDefinitions().end(); ++i )
+                    defs[Token::getSymbolId(i.key())][f].append(i.value() );
+            }
+
+            edges += r.getCalls();
+
+            Trace::Span span("merge atoms", f, Trace::Span::FileName);
+            Reader::Atoms::const_iterator j;
+            for( j = r.getAtoms().begin(); j != r.getAtoms().end(); ++j )
+            {
+                const quint32 id = Token::getSymbolId(j.key());
+                Reader::Atom& a = atoms[id];
+                a.props.unite(j.value().props);
+                Reader::Properties::const_iterator k;
+                for( k = j.value().props.begin(); k != j.value().props.end(); ++k )
+                {
+                    if( k.key() == 0 )
+                        continue;
+                    Holders& h = holders[Token::getSymbolId(k.key())];
+                    Holders::const_iterator i = h.constFind(id);
+                    while( i != h.constEnd() && i.key() == id && i.value().file != f )
+                        ++i;
+                    if( i == h.constEnd() || i.key() != id )
+                        h.insert(id, Holder(f, j.value().propPos.value(k.key(), NoPos)));
+                }
+#if 0
+                qDebug() << "**** atom" << j.key() << "properties";
+                for( Reader::Properties::const_iterator k = a.props.begin(); k != a.props.end(); ++k )
+                    qDebug() << "  " << k.key() << "=" << k.value().toString();
+#endif
+            }
+
+#if 0
+            QTextStream out;
+            QFile file(f + ".dump");
+            if( file.open(QFile::WriteOnly) )
+            {
+                out.setDevice(&file);
+                ast.print(out);
+            }
+#endif
+#if 0
+            QFile file(f + ".lisp");
+            if( file.open(QFile::WriteOnly) )
+            {
+                in.reset();
+                QString code = decode(in.readAll());
+                file.write( code.toUtf8() );
+            }
+#endif
+        }
+    }
+    calls.build(edges, Token::getSymbolCount());
+}
+
+enum { MallocOverhead = 16, ContainerHeader = 16 };
+
+template<class T>
+static qint64 bytesOf(const QList<T>& l)
+{
+    // QList keeps small movable items in its pointer array, all others on the heap
+    if( l.isEmpty() )
+        return 0;
+    qint64 res = ContainerHeader + MallocOverhead + qint64(l.size()) * sizeof(void*);
+    if( QTypeInfo<T>::isLarge || QTypeInfo<T>::isStatic )
+        res += qint64(l.size()) * ( sizeof(T) + MallocOverhead );
+    return res;
+}
+
+template<class K, class V>
+static qint64 bytesOf(const QHash<K,V>& h)
+{
+    if( h.isEmpty() )
+        return 0;
+    return ContainerHeader + MallocOverhead + qint64(h.capacity()) * sizeof(void*) +
+            qint64(h.size()) * ( sizeof(QHashNode<K,V>) + MallocOverhead );
+}
+
+static inline qint64 bytesOf(const QByteArray& ba)
+{
+    if( ba.capacity() == 0 )
+        return 0; // shared null or raw data
+    return ContainerHeader + MallocOverhead + ba.capacity() + 1;
+}
+
+static void countAst(const Reader::Object& o, qint64& lists, qint64& strings, qint64& nodes,
+                     QSet<const void*>* seen)
+{
+    // with hash-consing, shared nodes are only counted at their first occurrence
+    switch( o.type() )
+    {
+    case Reader::Object::List_: {
+            const Reader::List* l = o.getList();
+            if( seen && seen->contains(l) )
+                break;
+            if( seen )
+                seen->insert(l);
+            lists += sizeof(Reader::List) + MallocOverhead + bytesOf(l->list) + bytesOf(l->elementPositions);
+            nodes++;
+            for( int i = 0; i < l->list.size(); i++ )
+                countAst(l->list[i], lists, strings, nodes, seen);
+            break;
+        }
+    case Reader::Object::String_:
+        if( seen && seen->contains(o.getStr()) )
+            break;
+        if( seen )
+            seen->insert(o.getStr());
+        strings += sizeof(Reader::String) + MallocOverhead + bytesOf(o.getStr()->str);
+        nodes++;
+        break;
+    default:
+        break; // numbers and atoms are immediate in the Object
+    }
+}
+
+static qint64 bytesOf(const QVector<Project::Usage>& index, qint64& refs, qint64& buckets)
+{
+    qint64 res = index.capacity() * sizeof(Project::Usage);
+    for( int k = 0; k < index.size(); k++ )
+    {
+        const Project::Usage& u = index[k];
+        if( u.isEmpty() )
+            continue;
+        buckets++;
+        res += bytesOf(u);
+        for( Project::Usage::const_iterator l = u.begin(); l != u.end(); ++l )
+        {
+            res += bytesOf(l.value());
+            refs += l.value().size();
+        }
+    }
+    return res;
+}
+
+static QString toKb(qint64 bytes)
+{
+    return QString("%1 KB").arg((bytes + 512) / 1024);
+}
+
+static bool heavier(const QPair<qint64,QString>& lhs, const QPair<qint64,QString>& rhs)
+{
+    return lhs.first > rhs.first;
+}
+
+QStringList Project::memoryReport(int heaviest) const
+{
+    qint64 lists = 0, strings = 0, nodes = 0;
+    QSet<const void*> seen;
+    QList< QPair<qint64,QString> > files;
+    QMap<QString,Reader::Object>::const_iterator i;
+    for( i = asts.begin(); i != asts.end(); ++i )
+    {
+        qint64 l = 0, s = 0;
+        countAst(i.value(), l, s, nodes, cons ? &seen : 0);
+        lists += l;
+        strings += s;
+        files << qMakePair(l + s, i.key());
+    }
+
+    qint64 lineTables = 0;
+    QMap<QString,LineTable>::const_iterator j;
+    for( j = lines.begin(); j != lines.end(); ++j )
+        lineTables += j.value().byteSize() + MallocOverhead;
+    QMap<QString,QVector<quint32> >::const_iterator p;
+    for( p = positions.begin(); p != positions.end(); ++p )
+        lineTables += p.value().capacity() * sizeof(quint32) + ContainerHeader + MallocOverhead;
+
+    qint64 scopeBytes = 0, bound = 0;
+    QMap<QString,Reader::Scoping>::const_iterator s;
+    for( s = scoping.begin(); s != scoping.end(); ++s )
+    {
+        scopeBytes += s.value().capacity() * sizeof(quint64) + ContainerHeader + MallocOverhead;
+        bound += s.value().size();
+    }
+
+    qint64 refs = 0, buckets = 0, sites = 0, defined = 0;
+    const qint64 xrefBytes = bytesOf(xref, refs, buckets);
+    const qint64 defBytes = bytesOf(defs, sites, defined);
+
+    qint64 holderBytes = holders.capacity() * sizeof(Holders), holderCount = 0;
+    for( int k = 0; k < holders.size(); k++ )
+    {
+        holderBytes += bytesOf(holders[k]);
+        holderCount += holders[k].size();
+    }
+
+    qint64 atomBytes = atoms.capacity() * sizeof(Reader::Atom), props = 0;
+    for( int k = 0; k < atoms.size(); k++ )
+    {
+        atomBytes += bytesOf(atoms[k].props) + bytesOf(atoms[k].vector);
+        props += atoms[k].props.size();
+    }
+
+    const qint64 symbols = Token::getSymbolTableBytes();
+    const qint64 consBytes = cons ? cons->byteSize() : 0;
+    const qint64 total = lists + strings + lineTables + scopeBytes + xrefBytes + defBytes + atomBytes +
+            holderBytes + symbols + consBytes + calls.byteSize();
+
+    QStringList res;
+    res << QString("memory (approximate): %1 in total").arg(toKb(total));
+    res << QString("  ASTs: %1 in %2 nodes (lists %3, strings %4)").arg(toKb(lists + strings)).arg(nodes)
+           .arg(toKb(lists)).arg(toKb(strings));
+    res << QString("  line tables%1: %2").arg(cons ? " and position streams" : "").arg(toKb(lineTables));
+    res << QString("  xref: %1 in %2 atom buckets with %3 refs").arg(toKb(xrefBytes)).arg(buckets).arg(refs);
+    res << QString("  scope resolution: %1 for %2 bound uses").arg(toKb(scopeBytes)).arg(bound);
+    res << QString("  definitions: %1 for %2 atoms with %3 sites").arg(toKb(defBytes)).arg(defined).arg(sites);
+    res << QString("  atom properties: %1 for %2 properties (values are shared with the ASTs)")
+           .arg(toKb(atomBytes)).arg(props);
+    res << QString("  property index: %1 for %2 holders").arg(toKb(holderBytes)).arg(holderCount);
+    res << QString("  intern table: %1 for %2 symbols").arg(toKb(symbols)).arg(Token::getSymbolCount());
+    res << QString("  call graph: %1 for %2 calls").arg(toKb(calls.byteSize())).arg(calls.edgeCount());
+    if( cons )
+        res << QString("  hash-cons table: %1 for %2 unique lists and strings, %3 duplicates shared")
+               .arg(toKb(consBytes)).arg(cons->size()).arg(cons->getHits());
+    std::sort(files.begin(), files.end(), heavier);
+    for( int k = 0; k < files.size() && k < heaviest; k++ )
+        res << QString("  AST of %1: %2").arg(QFileInfo(files[k].second).fileName()).arg(toKb(files[k].first));
+    return res;
+}
+
+QString Project::debang( const QString& str )
+{
+    const int pos = str.lastIndexOf('!');
+    if( pos == -1 )
+        return str;
+    else
+        return str.left(pos);
+}
+
+QString Project::decode(const QByteArray& source)
+{
+    QByteArray bytes;
+    const int len = source.size();
+    for( int i = 0; i < len; i++ )
+    {
+        const char ch = source[i];
+        if( ch == '\r' )
+        {
+            if( i >= len-1 || source[i+1] != '\n' )
+                bytes += '\n';
+            else
+                bytes += ' ';
+        }else if( ch == '_' )
+            bytes += "←";
+        else if( ch == '^' )
+            bytes += "↑";
+        else if( isprint(ch) || isspace(ch) )
+            bytes += ch;
+        else if( !bytes.isEmpty() && bytes[bytes.size()-1] == '%' )
+            bytes += ' ';
+    }
+    return QString::fromUtf8(bytes);
+}
+
+QStringList Project::collectFiles( const QDir& dir )
+{
+    QStringList res;
+    QStringList files = dir.entryList( QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name );
+
+    foreach( const QString& f, files )
+        res += collectFiles( QDir( dir.absoluteFilePath(f) ) );
+
+    const QStringList all = dir.entryList(QDir::Files, QDir::Name);
+    QMap<QString,QString> check;
+    bool hasCompiled = false;
+    foreach( const QString& a, all )
+    {
+        QFileInfo info(a);
+        const QString suff = debang(info.suffix().toLower());
+        if( suff.isEmpty() || suff == "lisp" )
+            check.insert(debang(info.baseName().toLower()), a);
+        // not relibale; some source trees have lcom/dcom for a random subset of source files
+        // if( suff == "lcom" || suff == "dfasl" || suff == "dcom" )
+        //    hasCompiled = true;
+    }
+
+    foreach( const QString& a, all )
+    {
+        QFileInfo info(a);
+        if( !hasCompiled )
+        {
+            const QString suff = debang(info.suffix().toLower());
+            if( suff == "dump" || suff == "lcom" || suff == "dfasl" || suff == "dcom" )
+                continue;
+            QFile f(dir.absoluteFilePath(a));
+            if( f.open(QIODevice::ReadOnly) )
+            {
+                const QString header = decode(f.read(20));
+                if( header.startsWith("(FILECREATED") || header.startsWith("(DEFINE-FILE-INFO") )
+                    res.append(f.fileName());
+                else
+                    qDebug() << "no source file" << f.fileName();
+            }
+        }else
+        {
+            const QString suff = debang(info.suffix().toLower());
+            if( suff == "lcom" || suff == "dfasl" || suff == "dcom" )
+            {
+                const QString name = check.value(debang(info.baseName().toLower()));
+                if( !name.isEmpty() )
+                    res.append(dir.absoluteFilePath(name));
+                else
+                    qDebug() << "no source found for" << dir.absoluteFilePath(a);
+            }
+        }
+    }
+    return res;
+}
@@ -0,0 +1,80 @@
+#ifndef LISPPROJECT_H
+#define LISPPROJECT_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include <QMap>
+#include <QStringList>
+#include <QVector>
+#include "LispReader.h"
+#include "LispCallGraph.h"
+
+class QDir;
+
+namespace Lisp
+{
+
+// The parsed and indexed source tree, independent of the GUI
+class Project
+{
+public:
+    typedef QHash<QString,Reader::Refs> Usage; // file -> refs
+    struct Holder
+    {
+        QString file;
+        quint32 pos; // of the atom in the form which sets the property
+        Holder(const QString& f = QString(), quint32 p = NoPos):file(f),pos(p){}
+    };
+    typedef QMultiHash<quint32,Holder> Holders; // atom id -> files which set the property of the atom
+
+    Project();
+    ~Project();
+
+    void clear();
+    void setHashConsing(bool on); // share equal lists and strings across all files; see Reader::ConsTable
+    void setRoot(const QString& path); // clears and collects the source files
+    void parse(); // reads all source files, merges their xref and properties and builds the call graph
+    QStringList memoryReport(int heaviest = 10) const; // approximate bytes per subsystem
+
+    static QString decode(const QByteArray& source);
+    static QString debang(const QString& str);
+    static QStringList collectFiles(const QDir& dir);
+
+    QString root;
+    QStringList sourceFiles;
+    QMap<QString,Reader::Object> asts;
+    QMap<QString,LineTable> lines; // file -> line starts
+    QMap<QString,Reader::Scoping> scoping; // file -> uses bound to their declarations
+    QMap<QString,QVector<quint32> > positions; // file -> position stream, only with hash-consing
+    QVector<Usage> xref; // atom id -> usage
+    QVector<Usage> defs; // atom id -> defining sites, see Reader::getDefinitions
+    QVector<Reader::Atom> atoms; // atom id -> properties
+    QVector<Holders> holders; // property name atom id -> atoms which have the property
+    CallGraph calls;
+    Reader::ConsTable* cons;
+private:
+    Project(const Project&);
+    Project& operator=(const Project&);
+};
+
+}
+
+#endif // LISPPROJECT_H
@@ -0,0 +1,371 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include "LispQuery.h"
+#include "LispProject.h"
+#include "LispLexer.h"
+#include "LispTrace.h"
+#include <QRunnable>
+#include <ctype.h>
+using namespace Lisp;
+
+class Query::Task : public QRunnable
+{
+public:
+    Query* q;
+    QString file;
+    const Reader::List* root;
+    const QVector<quint32>* stream;
+    Task(Query* q, const QString& f, const Reader::List* r, const QVector<quint32>* s):
+        q(q),file(f),root(r),stream(s) {}
+    void run()
+    {
+        Trace::Span span("query", file, Trace::Span::FileName);
+        QList<Match> res;
+        if( !q->cancelled.load() )
+            q->search(file, root, stream, -1, res);
+        if( !res.isEmpty() )
+        {
+            QMutexLocker guard(&q->lock);
+            q->pending += res;
+            q->count.fetchAndAddOrdered(res.size());
+        }
+        q->remaining.fetchAndAddOrdered(-1);
+    }
+};
+
+Query::Query()
+{
+
+}
+
+Query::~Query()
+{
+    cancel();
+    wait();
+}
+
+bool Query::compile(const QString& pattern)
+{
+    nodes.clear();
+    kids.clear();
+    error.clear();
+    const QByteArray str = pattern.toUtf8();
+    int pos = 0;
+    if( parse(str, pos) < 0 )
+        return false;
+    while( pos < str.size() && isspace(str[pos]) )
+        pos++;
+    if( pos < str.size() )
+    {
+        error = QString("unexpected text after the pattern at %1").arg(pos);
+        return false;
+    }
+    return true;
+}
+
+int Query::parse(const QByteArray& str, int& pos)
+{
+    while( pos < str.size() && isspace(str[pos]) )
+        pos++;
+    if( pos >= str.size() )
+    {
+        error = "unexpected end of pattern";
+        return -1;
+    }
+    Node n;
+    const char c = str[pos];
+    if( c == ')' )
+    {
+        error = QString("unexpected ')' at %1").arg(pos);
+        return -1;
+    }else if( c == '(' )
+    {
+        pos++;
+        QVector<int> elems;
+        while( true )
+        {
+            while( pos < str.size() && isspace(str[pos]) )
+                pos++;
+            if( pos >= str.size() )
+            {
+                error = "missing ')'";
+                return -1;
+            }
+            if( str[pos] == ')' )
+            {
+                pos++;
+                break;
+            }
+            const int e = parse(str, pos);
+            if( e < 0 )
+                return -1;
+            elems.append(e);
+        }
+        n.kind = Node::List;
+        n.first = kids.size();
+        n.count = elems.size();
+        kids += elems;
+        if( pos < str.size() && str[pos] == '#' )
+        {
+            pos++;
+            if( pos >= str.size() || ( str[pos] != '=' && str[pos] != '<' && str[pos] != '>' ) )
+            {
+                error = QString("expecting '=', '<' or '>' after '#' at %1").arg(pos);
+                return -1;
+            }
+            n.arityOp = str[pos++];
+            const int start = pos;
+            while( pos < str.size() && isdigit(str[pos]) )
+                pos++;
+            if( pos == start )
+            {
+                error = QString("expecting a number at %1").arg(pos);
+                return -1;
+            }
+            n.arity = str.mid(start, pos - start).toInt();
+        }
+    }else if( c == '"' )
+    {
+        const int start = pos++;
+        while( pos < str.size() && str[pos] != '"' )
+            pos++;
+        if( pos >= str.size() )
+        {
+            error = "missing '\"'";
+            return -1;
+        }
+        pos++;
+        n.kind = Node::String;
+        n.str = str.mid(start, pos - start); // the Lexer keeps the quotes too
+    }else
+    {
+        const int start = pos;
+        while( pos < str.size() && !isspace(str[pos]) && str[pos] != '(' && str[pos] != ')' && str[pos] != '"' )
+            pos++;
+        const QByteArray tok = str.mid(start, pos - start);
+        bool ok;
+        if( tok == "*" )
+            n.kind = Node::Rest;
+        else if( tok.startsWith('?') )
+        {
+            n.kind = Node::Any;
+            n.str = tok.mid(1);
+        }else
+        {
+            const qint64 i = tok.toLongLong(&ok);
+            if( ok )
+            {
+                n.kind = Node::Integer;
+                n.num = i;
+            }else
+            {
+                const double d = tok.toDouble(&ok);
+                if( ok )
+                {
+                    n.kind = Node::Float;
+                    n.num = d;
+                }else
+                {
+                    n.kind = Node::Atom;
+                    n.atom = Token::getSymbolId(Token::getSymbol(tok).constData());
+                }
+            }
+        }
+    }
+    nodes.append(n);
+    return nodes.size() - 1;
+}
+
+bool Query::matches(const Reader::Object& o, Captures& caps) const
+{
+    if( nodes.isEmpty() )
+        return false;
+    caps.clear();
+    return match(nodes.size() - 1, o, caps);
+}
+
+bool Query::match(int node, const Reader::Object& o, Captures& caps) const
+{
+    // objects are only accessed by reference, since the reference counts are not thread-safe
+    const Node& n = nodes[node];
+    switch( n.kind )
+    {
+    case Node::Atom:
+        return o.type() == Reader::Object::Atom_ && o.getAtomId() == n.atom;
+    case Node::Integer:
+        return o.type() == Reader::Object::Integer && o.getInt() == qint64(n.num);
+    case Node::Float:
+        return o.type() == Reader::Object::Float && o.getDouble() == n.num;
+    case Node::String:
+        return o.type() == Reader::Object::String_ && o.getStr()->str == n.str;
+    case Node::Any:
+        if( !n.str.isEmpty() )
+        {
+            const QByteArray text = o.toString(true);
+            for( int i = 0; i < caps.size(); i++ )
+            {
+                if( caps[i].first == n.str )
+                    return caps[i].second == text;
+            }
+            caps.append(qMakePair(n.str, text));
+        }
+        return true;
+    case Node::Rest:
+        return true; // only at the top, within lists see matchElements
+    case Node::List:
+        {
+            if( o.type() != Reader::Object::List_ )
+                return false;
+            const Reader::List* l = o.getList();
+            const int args = l->list.size() - 1;
+            if( ( n.arityOp == '=' && args != n.arity ) || ( n.arityOp == '<' && args >= n.arity ) ||
+                    ( n.arityOp == '>' && args <= n.arity ) )
+                return false;
+            return matchElements(n, 0, l, 0, caps);
+        }
+    }
+    return false;
+}
+
+bool Query::matchElements(const Node& n, int i, const Reader::List* l, int j, Captures& caps) const
+{
+    // pattern elements from i on against list elements from j on; '*' tries the shortest rest first
+    if( i == n.count )
+        return j == l->list.size();
+    const int node = kids[n.first + i];
+    const int mark = caps.size();
+    if( nodes[node].kind == Node::Rest )
+    {
+        for( int k = j; k <= l->list.size(); k++ )
+        {
+            if( matchElements(n, i + 1, l, k, caps) )
+                return true;
+            caps.erase(caps.begin() + mark, caps.end());
+        }
+        return false;
+    }
+    if( j >= l->list.size() )
+        return false;
+    if( match(node, l->list[j], caps) && matchElements(n, i + 1, l, j + 1, caps) )
+        return true;
+    caps.erase(caps.begin() + mark, caps.end());
+    return false;
+}
+
+static QByteArray excerpt(const Reader::Object& o)
+{
+    QByteArray str = o.toString(true).simplified();
+    if( str.size() > 100 )
+        str = str.left(97) + "...";
+    return str;
+}
+
+void Query::search(const QString& file, const Reader::List* l, const QVector<quint32>* stream, int at,
+                   QList<Match>& res) const
+{
+    // hash-consed lists are shared and have no element positions; instead the cursor walks the
+    // position stream of the file, see Reader::ConsTable
+    const bool root = at < 0;
+    int cur = root ? 0 : at;
+    Captures caps;
+    for( int i = 0; i < l->list.size(); i++ )
+    {
+        const Reader::Object& o = l->list[i];
+        quint32 pos = NoPos;
+        int child = 0;
+        if( stream )
+        {
+            if( !root && cur < stream->size() )
+                pos = stream->at(cur++);
+            if( o.type() == Reader::Object::List_ )
+            {
+                child = cur;
+                if( root && cur < stream->size() )
+                    pos = stream->at(cur); // the start of a top-level list is not recorded, but of its head
+                cur += o.getList()->span;
+            }
+        }else if( i < l->elementPositions.size() )
+            pos = l->elementPositions[i];
+        if( match(nodes.size() - 1, o, caps) )
+        {
+            Match m;
+            m.file = file;
+            m.pos = pos;
+            m.text = excerpt(o);
+            m.captures = caps;
+            res << m;
+        }
+        caps.clear();
+        if( o.type() == Reader::Object::List_ )
+        {
+            if( root && cancelled.load() )
+                return; // checked per top-level form
+            search(file, o.getList(), stream, child, res);
+        }
+    }
+}
+
+void Query::start(const QList<Project*>& projects)
+{
+    cancel();
+    wait();
+    cancelled = 0;
+    count = 0;
+    pending.clear();
+    if( nodes.isEmpty() )
+        return;
+    QList<Task*> tasks;
+    foreach( Project* p, projects )
+    {
+        QMap<QString,Reader::Object>::const_iterator i;
+        for( i = p->asts.constBegin(); i != p->asts.constEnd(); ++i )
+        {
+            if( i.value().type() == Reader::Object::List_ )
+            {
+                QMap<QString,QVector<quint32> >::const_iterator s = p->positions.constFind(i.key());
+                tasks << new Task(this, i.key(), i.value().getList(),
+                                  s == p->positions.constEnd() ? 0 : &s.value());
+            }
+        }
+    }
+    remaining = tasks.size();
+    foreach( Task* t, tasks )
+        pool.start(t);
+}
+
+void Query::cancel()
+{
+    cancelled = 1;
+}
+
+void Query::wait()
+{
+    pool.waitForDone();
+}
+
+QList<Query::Match> Query::takeMatches()
+{
+    QMutexLocker guard(&lock);
+    QList<Match> res = pending;
+    pending.clear();
+    return res;
+}
@@ -0,0 +1,107 @@
+#ifndef LISPQUERY_H
+#define LISPQUERY_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QPair>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+#include "LispReader.h"
+
+namespace Lisp
+{
+
+class Project;
+
+// Finds forms by shape. A pattern is written like a form:
+//   ATOM, 123, "str"   match an equal atom, number or string
+//   ?                  matches any one element, ?NAME also captures it (repeated names must be equal)
+//   *                  matches any number of elements of the enclosing list
+//   (p1 p2 ...)        matches a list whose elements match p1 p2 ...
+//   (...)#>N (...)#<N (...)#=N  additionally require more, less or exactly N elements after the head
+// e.g. (BITBLT *)#>10, (SELECTQ X *) or (PUTPROPS ? * MACRO *).
+// A pattern is compiled once and then matched against every element of all ASTs, one file per
+// task of a thread pool; the matches are collected while the tasks run.
+class Query
+{
+public:
+    typedef QList< QPair<QByteArray,QByteArray> > Captures; // name -> text
+    struct Match
+    {
+        QString file;
+        quint32 pos; // offset of the matching element, NoPos if unknown
+        QByteArray text;
+        Captures captures;
+        Match():pos(NoPos){}
+    };
+
+    Query();
+    ~Query();
+
+    bool compile(const QString& pattern); // not while a search is running, see cancel and wait
+    const QString& getError() const { return error; }
+    bool matches(const Reader::Object&, Captures&) const; // can be called from several threads
+
+    // the ASTs of the projects must neither be changed nor released until isDone
+    void start(const QList<Project*>& projects);
+    bool isDone() const { return remaining.load() == 0; }
+    void cancel();
+    void wait();
+    QList<Match> takeMatches(); // the matches found since the last call
+    int getMatchCount() const { return count.load(); }
+private:
+    struct Node
+    {
+        enum Kind { Atom, Integer, Float, String, Any, Rest, List };
+        quint8 kind;
+        char arityOp; // 0, '=', '<' or '>'
+        int arity;
+        quint32 atom;
+        double num;
+        QByteArray str; // String or the capture name of Any
+        int first, count; // of the element nodes in kids, only List
+        Node():kind(Any),arityOp(0),arity(0),atom(0),num(0),first(0),count(0){}
+    };
+    class Task;
+    friend class Task;
+    int parse(const QByteArray&, int& pos);
+    bool match(int node, const Reader::Object&, Captures&) const;
+    bool matchElements(const Node&, int i, const Reader::List*, int j, Captures&) const;
+    // at < 0: the list is the root of the file; stream: the position stream if hash-consed
+    void search(const QString& file, const Reader::List*, const QVector<quint32>* stream, int at,
+                QList<Match>&) const;
+
+    QVector<Node> nodes; // the root is the last one
+    QVector<int> kids;
+    QString error;
+    QThreadPool pool;
+    QMutex lock;
+    QList<Match> pending;
+    QAtomicInt remaining, count, cancelled;
+};
+
+}
+
+#endif // LISPQUERY_H
@@ -23,6 +23,14 @@
 #include <QHash>
 #include <QtDebug>
 #include <QFile>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include "LispTokenRing.h"
+#include "LispTrace.h"
 using namespace Lisp;
 
 static QHash<QByteArray,QByteArray> symbols;
@@ -31,31 +39,272 @@ static const quint64 signbit_mask = 1LL << (64-1);
 static const quint64 quiet_nan_mask = 0xfffLL << 51;
 static const quint64 pointer_type_mask = 7LL << 48;
 static const quint64 pointer_mask = (1LL << 48)-1;
+static const quint64 atom_mask = (1LL << 32)-1;
 static const quint64 int_mask = (1LL << 50) - 1;
 static const quint64 int_sign = 1LL << 50;
 static const quint64 Nil_mask = 1LL << 48;
 static const quint64 String_mask = 2LL << 48;
 static const quint64 List_mask = 3LL << 48;
 static const quint64 Atom_mask = 4LL << 48;
-static const char* STOP;
-static const char* NIL;
-static const char* DEFINEQ;
-static const char* QUOTE;
-static const char* PUTPROPS;
-static const char* PUTPROP;
-static const char* SET;
-static const char* SETQ;
-static const char* SETQQ;
-static const char* RPAQ;
-static const char* RPAQQ;
-static const char* PROG;
-static const char* LAMBDA;
-static const char* NLAMBDA;
+static const quint64 Cons_mask = 5LL << 48;
+static const int PipelineThreshold = 256 * 1024; // bytes; smaller files don't pay off the thread start
+static const int ParallelThreshold = 512 * 1024;
+static quint32 s_stop = 0;
+static quint32 s_nil = 0;
+static quint32 s_macro[3] = { 0, 0, 0 }; // the property names which make PUTPROPS a definition
+static QHash<quint32,Reader::SpecialForm> s_forms;
 
+Reader::SpecialForm::SpecialForm(Hint a1, Hint a2, Hint a3, Hint r, quint8 f):rest(r),flags(f)
+{
+    args[0] = a1;
+    args[1] = a2;
+    args[2] = a3;
+}
+
+void Reader::addSpecialForm(const char* head, const SpecialForm& f)
+{
+    initSpecialForms();
+    s_forms[Token::getSymbolId(Token::getSymbol(head).constData())] = f;
+}
+
+const Reader::SpecialForm* Reader::getSpecialForm(quint32 atomId)
+{
+    QHash<quint32,SpecialForm>::const_iterator i = s_forms.find(atomId);
+    if( i == s_forms.end() )
+        return 0;
+    return &i.value();
+}
+
+void Reader::initSpecialForms()
+{
+    static bool done = false;
+    if( done )
+        return;
+    done = true;
+    s_stop = Token::getSymbolId(Token::getSymbol("STOP").constData());
+    s_nil = Token::getSymbolId(Token::getSymbol("NIL").constData());
+    s_macro[0] = Token::getSymbolId(Token::getSymbol("MACRO").constData());
+    s_macro[1] = Token::getSymbolId(Token::getSymbol("DMACRO").constData());
+    s_macro[2] = Token::getSymbolId(Token::getSymbol("BYTEMACRO").constData());
+
+    // the arguments of QUOTE and of the NLAMBDA forms below are data, not forms
+    addSpecialForm("QUOTE", SpecialForm(Quoted, Quoted, Quoted, Quoted));
+    addSpecialForm("LAMBDA", SpecialForm(Param));
+    addSpecialForm("NLAMBDA", SpecialForm(Param));
+    addSpecialForm("PROG", SpecialForm(Bindings));
+    addSpecialForm("LET", SpecialForm(Bindings));
+    addSpecialForm("LET*", SpecialForm(Bindings, None, None, None, SpecialForm::Sequential));
+    addSpecialForm("RESETVARS", SpecialForm(Bindings));
+    addSpecialForm("RESETLST", SpecialForm());
+    addSpecialForm("COND", SpecialForm(Clause, Clause, Clause, Clause));
+    addSpecialForm("SELECTQ", SpecialForm(None, SelectClause, SelectClause, SelectClause));
+    addSpecialForm("DEFINEQ", SpecialForm(Definition, Definition, Definition, Definition));
+    addSpecialForm("SET", SpecialForm(None, None, None, None, SpecialForm::AssignsFirst));
+    addSpecialForm("SETQ", SpecialForm(None, None, None, None, SpecialForm::AssignsFirst));
+    addSpecialForm("RPAQ", SpecialForm(None, None, None, None,
+                                       SpecialForm::AssignsFirst | SpecialForm::DefinesFirst));
+    addSpecialForm("SETQQ", SpecialForm(None, Data, Data, Data, SpecialForm::AssignsFirst));
+    addSpecialForm("RPAQQ", SpecialForm(None, Data, Data, Data,
+                                        SpecialForm::AssignsFirst | SpecialForm::DefinesFirst));
+    addSpecialForm("PUTPROP", SpecialForm(None, None, None, None,
+                                          SpecialForm::AssignsFirst | SpecialForm::PropValue));
+    addSpecialForm("PUTPROPS", SpecialForm(None, Data, Data, Data,
+                                           SpecialForm::AssignsFirst | SpecialForm::PropValue |
+                                           SpecialForm::PropPairs | SpecialForm::DefinesMacro));
+    addSpecialForm("DEFINE-FILE-INFO", SpecialForm(Data, Data, Data, Data));
+    addSpecialForm("FILECREATED", SpecialForm(Data, Data, Data, Data));
+    addSpecialForm("RECORD", SpecialForm(None, Data, Data, Data,
+                                         SpecialForm::AssignsFirst | SpecialForm::DefinesFirst));
+    addSpecialForm("TYPERECORD", SpecialForm(None, Data, Data, Data,
+                                             SpecialForm::AssignsFirst | SpecialForm::DefinesFirst));
+    addSpecialForm("DATATYPE", SpecialForm(None, Data, Data, Data,
+                                           SpecialForm::AssignsFirst | SpecialForm::DefinesFirst));
+}
+
+static inline bool isData(Reader::Hint h)
+{
+    return h == Reader::Quoted || h == Reader::Data;
+}
+
+static Reader::Hint elementHint(Reader::Hint outerHint, const Reader::SpecialForm* form, int index)
+{
+    // outerHint tells how the list itself was read, the result how its element at index is read
+    switch( outerHint )
+    {
+    case Reader::Quoted:
+    case Reader::Data:
+        return Reader::Data;
+    case Reader::Local:
+    case Reader::Param:
+        return outerHint;
+    case Reader::Bindings:
+        return Reader::Binding; // either an atom or a (var init) list
+    case Reader::Binding:
+        return index == 0 ? Reader::Local : Reader::None;
+    case Reader::SelectClause:
+        return index == 0 ? Reader::Data : Reader::None;
+    case Reader::Definition:
+    case Reader::Clause:
+        return Reader::None;
+    default:
+        break;
+    }
+    if( index == 0 || form == 0 )
+        return Reader::None;
+    return form->hint(index);
+}
+
+static Reader::Ref::Role elementRole(Reader::Hint outerHint, Reader::Hint hint, const Reader::SpecialForm* form, int index)
+{
+    if( isData(outerHint) || hint == Reader::Data )
+        return Reader::Ref::Use;
+    if( hint == Reader::Local || hint == Reader::Binding )
+        return Reader::Ref::Local;
+    if( hint == Reader::Param )
+        return Reader::Ref::Param;
+    switch( outerHint )
+    {
+    case Reader::Definition:
+        return index == 0 ? Reader::Ref::Func : Reader::Ref::Use;
+    case Reader::Clause:
+    case Reader::SelectClause:
+        return Reader::Ref::Use;
+    default:
+        break;
+    }
+    if( index == 0 )
+        return Reader::Ref::Call;
+    if( index == 1 && form && ( form->flags & Reader::SpecialForm::AssignsFirst ) )
+        return Reader::Ref::Lhs;
+    return Reader::Ref::Use;
+}
+
+struct Chunk
+{
+    int from, to; // bytes of the file
+    quint32 start; // offset of from, see LispRowCol.h
+};
+
+static inline bool isClutter(char c)
+{
+    // the chars Lexer::readc ignores
+    return c == 0 || ( !isprint(c) && !isspace(c) );
+}
+
+static QVector<Chunk> splitAtTopLevel(const QByteArray& code, int count)
+{
+    // MAKEFILE puts each top-level form on its own line, so a '(' at the start of a line outside of
+    // any list, string or escape starts a form; the result is empty if the structure is ambiguous
+    QVector<Chunk> res;
+    const char* data = code.constData();
+    const int len = code.size();
+    const int target = qMax(len / qMax(count, 1), 1);
+    QList<int> brackets; // depth of each open '['
+    int depth = 0;
+    bool inString = false, escape = false;
+    char last = 0;
+    quint32 offset = 0; // counted like Project::decode and Lexer::readc
+    Chunk cur;
+    cur.from = 0;
+    cur.start = 0;
+    for( int i = 0; i < len; i++ )
+    {
+        char c = data[i];
+        if( c != '\r' && isClutter(c) )
+        {
+            if( last != '%' )
+                continue;
+            c = ' '; // escaped clutter is read as a blank
+        }
+        const bool lineStart = i > 0 && ( data[i-1] == '\n' || data[i-1] == '\r' );
+        if( depth == 0 && !inString && !escape && lineStart )
+        {
+            if( c == '(' && i - cur.from >= target )
+            {
+                cur.to = i;
+                res.append(cur);
+                cur.from = i;
+                cur.start = offset;
+            }else if( c == 'S' && ::strncmp(data + i, "STOP", qMin(4, len - i)) == 0 &&
+                      ( i + 4 >= len || Lexer::atom_delimiter(data[i+4]) ) )
+                break; // the remainder is not read anyway
+        }
+        offset++;
+        last = c;
+        if( escape )
+        {
+            escape = false;
+            continue;
+        }
+        if( c == '%' )
+        {
+            escape = true;
+            continue;
+        }
+        if( c == '"' )
+        {
+            inString = !inString;
+            continue;
+        }
+        if( inString )
+            continue;
+        switch( c )
+        {
+        case '(':
+            depth++;
+            break;
+        case '[':
+            brackets.append(depth);
+            depth++;
+            break;
+        case ')':
+            if( depth == 0 || ( !brackets.isEmpty() && brackets.last() == depth - 1 ) )
+                return QVector<Chunk>(); // unexpected ')' or '[' terminated by ')'
+            depth--;
+            break;
+        case ']':
+            if( brackets.isEmpty() )
+                return QVector<Chunk>(); // ']' closing more than the top-level form
+            depth = brackets.takeLast();
+            break;
+        }
+    }
+    if( inString || escape || depth != 0 )
+        return QVector<Chunk>();
+    cur.to = len;
+    res.append(cur);
+    return res;
+}
 
-Reader::Reader()
+class Reader::ChunkTask : public QRunnable
 {
+public:
+    Reader r;
+    const char* data;
+    int len;
+    quint32 start;
+    QString path;
+    bool stopped;
+
+    ChunkTask(const char* d, int l, quint32 s, const QString& p):data(d),len(l),start(s),path(p),stopped(false)
+    {
+        setAutoDelete(false);
+    }
+    void run()
+    {
+        Trace::Span span("chunk", path);
+        List* l = new List();
+        r.ast.set(l);
+        Lexer lex;
+        lex.setStream(data, len, path, start);
+        stopped = r.readForms(lex, l);
+        r.lines = lex.getLines();
+    }
+};
 
+Reader::Reader():pos(NoPos),pendingBrack(NoPos),mode(Auto),cons(0),caller(0),sequential(false)
+{
+    initSpecialForms();
 }
 
 bool Reader::read(QIODevice* in, const QString& path)
@@ -63,40 +312,117 @@ bool Reader::read(QIODevice* in, const QString& path)
     List* l = new List();
     ast.set(l);
     xref.clear();
+    defs.clear();
     atoms.clear();
-    STOP = Token::getSymbol("STOP").constData();
-    NIL = Token::getSymbol("NIL").constData();
-    DEFINEQ = Token::getSymbol("DEFINEQ").constData();
-    QUOTE = Token::getSymbol("QUOTE").constData();
-    PUTPROPS = Token::getSymbol("PUTPROPS").constData();
-    PUTPROP = Token::getSymbol("PUTPROP").constData();
-    SET = Token::getSymbol("SET").constData();
-    SETQ = Token::getSymbol("SETQ").constData();
-    SETQQ = Token::getSymbol("SETQQ").constData();
-    RPAQ = Token::getSymbol("RPAQ").constData();
-    RPAQQ = Token::getSymbol("RPAQQ").constData();
-    PROG = Token::getSymbol("PROG").constData();
-    LAMBDA = Token::getSymbol("LAMBDA").constData();
-    NLAMBDA = Token::getSymbol("NLAMBDA").constData();
-
-    Lexer lex;
-    lex.setStream(in, path);
+    calls.clear();
+    scoping.clear();
+    scope.clear();
+    pending.clear();
+    sequential = false;
+    caller = 0;
+    lines.clear();
+    positions.clear();
+    pendingBrack = NoPos;
+
+    // lexing from memory is much cheaper than calling QIODevice::getChar per character
+    const QByteArray code = in->readAll();
+    const bool multiCore = QThread::idealThreadCount() > 1;
+    if( cons == 0 && ( mode == Parallel || ( mode == Auto && multiCore && code.size() >= ParallelThreshold ) ) &&
+            readParallel(code, path) )
+        ; // done
+    else if( mode == Pipelined || ( mode == Auto && multiCore && code.size() >= PipelineThreshold ) )
+    {
+        // the lexer runs on another core ahead of the reader
+        TokenRing ring;
+        ring.start(code.constData(), code.size(), path);
+        readForms(ring, l);
+        ring.stop();
+        lines = ring.getLines();
+    }else
+    {
+        Lexer lex;
+        lex.setStream(code.constData(), code.size(), path);
+        readForms(lex, l);
+        lines = lex.getLines();
+    }
+    return error.isEmpty();
+}
+
+bool Reader::readParallel(const QByteArray& code, const QString& path)
+{
+    const int threads = QThread::idealThreadCount();
+    const QVector<Chunk> chunks = splitAtTopLevel(code, threads * 4);
+    if( chunks.size() < 2 )
+        return false;
+
+    QList<ChunkTask*> tasks;
+    for( int i = 0; i < chunks.size(); i++ )
+        tasks << new ChunkTask(code.constData() + chunks[i].from, chunks[i].to - chunks[i].from,
+                               chunks[i].start, path);
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for( int i = 1; i < tasks.size(); i++ )
+        pool.start(tasks[i]);
+    tasks.first()->run();
+    pool.waitForDone();
+
+    // stitch the chunks in file order, as if read serially
+    List* root = ast.getList();
+    for( int i = 0; i < tasks.size(); i++ )
+    {
+        const Reader& r = tasks[i]->r;
+        const List* l = r.ast.getList();
+        for( int j = 0; j < l->list.size(); j++ )
+        {
+            if( l->list[j].type() == Object::List_ )
+                l->list[j].getList()->outer = root;
+            root->list.append(l->list[j]);
+            root->elementPositions.append(l->elementPositions[j]);
+        }
+        for( Xref::const_iterator k = r.xref.begin(); k != r.xref.end(); ++k )
+            xref[k.key()] += k.value();
+        for( Xref::const_iterator k = r.defs.begin(); k != r.defs.end(); ++k )
+            defs[k.key()] += k.value();
+        for( Atoms::const_iterator k = r.atoms.begin(); k != r.atoms.end(); ++k )
+        {
+            Atom& a = atoms[k.key()];
+            for( Properties::const_iterator p = k.value().props.begin(); p != k.value().props.end(); ++p )
+                a.props[p.key()] = p.value();
+            a.propPos.unite(k.value().propPos);
+        }
+        calls += r.calls;
+        scoping += r.scoping;
+        lines.append(r.lines);
+        if( !r.error.isEmpty() )
+        {
+            error = r.error;
+            pos = r.pos;
+            break;
+        }
+        if( tasks[i]->stopped )
+            break;
+    }
+    qDeleteAll(tasks);
+    return true;
+}
 
+bool Reader::readForms(TokenSource& lex, List* l)
+{
+    // returns true if the forms were terminated by NIL or STOP
     while( true )
     {
-        const Token t = lex.nextToken();
-        lex.unget(t);
-        Object res = next(lex, l);
+        const Token t = nextToken(lex);
+        Object res = next(lex, t, l);
         if( !error.isEmpty() )
-            return false;
+            break;
         if( res.type() != Object::Nil_ )
         {
             if( res.type() == Object::Atom_ )
             {
-                const char* atom = res.getAtom();
-                if( atom == NIL || atom == STOP )
-                    break;
-                xref[atom] << Ref(t.pos, t.len);
+                const quint32 id = res.getAtomId();
+                if( id == s_nil || id == s_stop )
+                    return true;
+                xref[res.getAtom()] << Ref(t.pos, t.len);
             }
             l->list.append(res);
             l->elementPositions.append(t.pos);
@@ -104,17 +430,23 @@ bool Reader::read(QIODevice* in, const QString& path)
         }else
             break;
     }
-    return error.isEmpty();
+    return false;
+}
+
+Token Reader::nextToken(TokenSource& in)
+{
+    if( pendingBrack != NoPos )
+    {
+        const Token t(Tok_rbrack, pendingBrack, 1);
+        pendingBrack = NoPos;
+        return t;
+    }
+    return in.nextToken();
 }
 
-Reader::Object Reader::next(Lexer& in, List* outer, Hint hint)
+Reader::Object Reader::next(TokenSource& in, const Token& t, List* outer, Hint hint)
 {
     Object res;
-    if( hint == Quoted )
-        in.startQuote();
-    Token t = in.nextToken();
-    if( hint == Quoted )
-        in.endQuote();
     if( t.isEof() )
         return Object();
     pos = t.pos;
@@ -136,6 +468,8 @@ Reader::Object Reader::next(Lexer& in, List* outer, Hint hint)
         break;
     case Tok_string:
         res = Object(new String(t.val));
+        if( cons )
+            res = cons->intern(res);
         break;
     case Tok_atom:
         res = Object(t.val.constData());
@@ -156,16 +490,22 @@ Reader::Object Reader::next(Lexer& in, List* outer, Hint hint)
     return res;
 }
 
-Reader::Object Reader::list(Lexer& in, bool brack, List* outer, Hint outerHint)
+Reader::Object Reader::list(TokenSource& in, bool brack, List* outer, Hint outerHint)
 {
     List* l = new List();
-    l->outer = outer;
+    l->outer = cons ? 0 : outer;
     Object res(l);
-    Hint hint = None;
+    const SpecialForm* form = 0; // looked up once per list by its head atom
+    const int first = positions.size();
+    const int frame = scope.size();
+    const int pendingFrame = pending.size();
+    Ref lhs; // of a DefinesMacro form, until it turns out to be a definition
+    quint32 firstPos = NoPos; // of the element at index 1
+    const bool seq = outerHint == Bindings && sequential;
 
     while( true )
     {
-        Token t = in.nextToken();
+        const Token t = nextToken(in);
         if( !t.isValid() )
         {
             report(t);
@@ -174,7 +514,10 @@ Reader::Object Reader::list(Lexer& in, bool brack, List* outer, Hint outerHint)
         }
         if( t.type == Tok_rpar )
         {
-            l->end = t.pos;
+            if( cons )
+                positions.append(t.pos);
+            else
+                l->end = t.pos;
             if( brack )
             {
                 report(t,"terminating '[' by ')'");
@@ -185,65 +528,198 @@ Reader::Object Reader::list(Lexer& in, bool brack, List* outer, Hint outerHint)
         if( t.type == Tok_rbrack )
         {
             if( !brack )
-                in.unget(t); // shortcut to close all '(' lists up to '['
-            l->end = t.pos;
+                pendingBrack = t.pos; // shortcut to close all '(' lists up to '['
+            if( cons )
+                positions.append(t.pos);
+            else
+                l->end = t.pos;
             break;
         }
-        in.unget(t);
-        Object res = next(in, l, hint);
+        const int index = l->list.size();
+        const Hint hint = elementHint(outerHint, form, index);
+        if( cons )
+            positions.append(t.pos); // before the entries of a nested list
+        if( hint == Bindings )
+            sequential = form && ( form->flags & SpecialForm::Sequential );
+        Object res = next(in, t, l, hint);
         if( !error.isEmpty() )
         {
             res = Object();
             break;
         }
         l->list.append(res);
-        l->elementPositions.append(t.pos);
+        if( cons == 0 )
+            l->elementPositions.append(t.pos);
+        if( index == 1 )
+            firstPos = t.pos;
         if( res.type() == Object::Atom_ )
         {
-            if( l->list.size() == 1 )
+            if( index == 0 && outerHint == None )
+                form = getSpecialForm(res.getAtomId());
+            Ref::Role role = elementRole(outerHint, hint, form, index);
+            if( role == Ref::Param )
+                scope.append( quint64(res.getAtomId()) << 32 | t.pos );
+            else if( role == Ref::Local )
+                pending.append( quint64(res.getAtomId()) << 32 | t.pos ); // visible after the bindings list
+            else if( ( role == Ref::Use || role == Ref::Lhs ) && !scope.isEmpty() &&
+                     !isData(outerHint) && hint != Data )
             {
-                const char* atom = res.getAtom();
-                if( atom == QUOTE )
-                    hint = Quoted;
-                else if( atom == PROG )
-                    hint = Local;
-                else if( atom == LAMBDA || atom == NLAMBDA )
-                    hint = Param;
+                // the innermost declaration of the atom binds it
+                const quint32 id = res.getAtomId();
+                for( int i = scope.size() - 1; i >= 0; i-- )
+                {
+                    if( quint32(scope[i] >> 32) == id )
+                    {
+                        scoping.append( quint64(t.pos) << 32 | quint32(scope[i]) );
+                        if( role == Ref::Use )
+                            role = Ref::Bound;
+                        break;
+                    }
+                }
             }
-
-            const bool isDecl = outerHint == Local || outerHint == Param;
-            Ref::Role r = outerHint == Local ? Ref::Local : ( outerHint == Param ? Ref::Param : Ref::Use);
-            if( !isDecl && l->list.size() == 1 )
-            {
-                r = Ref::Call;
-                Object o = l->getOuterFirst();
-                if( o.type() == Object::Atom_ && o.getAtom() == DEFINEQ )
-                    r = Ref::Func;
-            }else if( !isDecl && l->list.size() == 2 &&
-                      (l->list.first().getAtom() == PUTPROP ||
-                       l->list.first().getAtom() == PUTPROPS ||
-                       l->list.first().getAtom() == SET || l->list.first().getAtom() == SETQ ||
-                       l->list.first().getAtom() == SETQQ || l->list.first().getAtom() == RPAQ ||
-                       l->list.first().getAtom() == RPAQQ ) )
+            xref[res.getAtom()] << Ref(t.pos, t.len, role);
+            if( role == Ref::Func || ( role == Ref::Lhs && ( form->flags & SpecialForm::DefinesFirst ) ) )
+                defs[res.getAtom()] << Ref(t.pos, t.len, role);
+            else if( role == Ref::Lhs && ( form->flags & SpecialForm::DefinesMacro ) )
+                lhs = Ref(t.pos, t.len, role);
+            else if( lhs.pos != NoPos && index >= 2 && index % 2 == 0 &&
+                     ( res.getAtomId() == s_macro[0] || res.getAtomId() == s_macro[1] ||
+                       res.getAtomId() == s_macro[2] ) )
             {
-                r = Ref::Lhs;
+                // a macro property, other properties like COPYRIGHT define nothing
+                defs[l->list[1].getAtom()] << lhs;
+                lhs = Ref();
             }
-            xref[res.getAtom()] << Ref(t.pos, t.len, r);
+            if( role == Ref::Func )
+                caller = res.getAtomId();
+            else if( role == Ref::Call && caller != 0 && ( form == 0 || form->hint(1) != Param ) )
+                calls.append( quint64(caller) << 32 | res.getAtomId() ); // LAMBDA and NLAMBDA are no calls
         }
-        if( l->list.size() == 4 && (l->list[0].getAtom() == PUTPROPS || l->list[0].getAtom() == PUTPROP) )
+        if( form && ( form->flags & SpecialForm::PropValue ) )
         {
-            //qDebug() << "Property of atom" << l->list[1].getAtom() << ":" << l->list[2].toString() << "=" << res.toString();
-            if( l->list[1].type() == Object::Atom_ && l->list[2].type() == Object::Atom_ )
-                atoms[l->list[1].getAtom()].props[l->list[2].getAtom()] = res;
-        }else if( l->list.size() >= 6 && l->list.size() % 2 == 0 && l->list[0].getAtom() == PUTPROPS )
+            const int n = l->list.size();
+            if( n == 4 )
+            {
+                //qDebug() << "Property of atom" << l->list[1].getAtom() << ":" << l->list[2].toString() << "=" << res.toString();
+                if( l->list[1].type() == Object::Atom_ && l->list[2].type() == Object::Atom_ )
+                {
+                    Atom& a = atoms[l->list[1].getAtom()];
+                    a.props[l->list[2].getAtom()] = res;
+                    a.propPos[l->list[2].getAtom()] = firstPos;
+                }
+            }else if( n >= 6 && n % 2 == 0 && ( form->flags & SpecialForm::PropPairs ) )
+            {
+                if( l->list[1].type() == Object::Atom_ && l->list[n-2].type() == Object::Atom_ )
+                {
+                    Atom& a = atoms[l->list[1].getAtom()];
+                    a.props[l->list[n-2].getAtom()] = res;
+                    a.propPos[l->list[n-2].getAtom()] = firstPos;
+                }
+            }
+        }
+        if( seq )
         {
-            if( l->list[1].type() == Object::Atom_ && l->list[l->list.size()-2].type() == Object::Atom_ )
-                atoms[l->list[1].getAtom()].props[l->list[l->list.size()-2].getAtom()] = res;
+            // LET*: the binding just read is visible in the inits of the following ones
+            scope += pending.mid(pendingFrame);
+            pending.resize(pendingFrame);
         }
     }
+    if( outerHint == Bindings )
+    {
+        // PROG, LET: the variables become visible in the body, not in the inits of the same form;
+        // they stay in the scope frame of the enclosing form
+        scope += pending.mid(pendingFrame);
+        pending.resize(pendingFrame);
+    }
+    if( outerHint == Definition )
+        caller = 0;
+    if( form && ( form->hint(1) == Param || form->hint(1) == Bindings ) )
+        scope.resize(frame); // the variables bound by this form go out of scope
+    if( cons && res.type() == Object::List_ )
+    {
+        l->span = positions.size() - first;
+        res = cons->intern(res);
+    }
     return res;
 }
 
+static uint identityHash(const Reader::List* l)
+{
+    uint h = l->list.size();
+    for( int i = 0; i < l->list.size(); i++ )
+        h = h * 31 + qHash(l->list[i].identity());
+    return h;
+}
+
+static bool sameElements(const Reader::List* a, const Reader::List* b)
+{
+    if( a->list.size() != b->list.size() )
+        return false;
+    for( int i = 0; i < a->list.size(); i++ )
+    {
+        if( !a->list[i].isSame(b->list[i]) )
+            return false;
+    }
+    return true;
+}
+
+Reader::Object Reader::ConsTable::intern(const Object& o)
+{
+    // the elements of a list are already interned, so comparing their identities is enough
+    if( o.type() == Object::String_ )
+    {
+        const QByteArray& str = o.getStr()->str;
+        QHash<QByteArray,Object>::const_iterator i = strings.constFind(str);
+        if( i != strings.constEnd() )
+        {
+            hits++;
+            return i.value();
+        }
+        strings.insert(str, o);
+        return o;
+    }
+    if( o.type() != Object::List_ )
+        return o;
+    const List* l = o.getList();
+    const uint h = identityHash(l);
+    QMultiHash<uint,Object>::const_iterator i = lists.constFind(h);
+    while( i != lists.constEnd() && i.key() == h )
+    {
+        if( sameElements(i.value().getList(), l) )
+        {
+            hits++;
+            return i.value();
+        }
+        ++i;
+    }
+    lists.insert(h, o);
+    return o;
+}
+
+qint64 Reader::ConsTable::byteSize() const
+{
+    enum { MallocOverhead = 16 };
+    return ( lists.capacity() + strings.capacity() ) * sizeof(void*) +
+            lists.size() * ( sizeof(QHashNode<uint,Object>) + MallocOverhead ) +
+            strings.size() * ( sizeof(QHashNode<QByteArray,Object>) + MallocOverhead );
+}
+
+void Reader::ConsTable::clear()
+{
+    lists.clear();
+    strings.clear();
+    hits = 0;
+}
+
+quint32 Reader::declarationOf(const Scoping& s, quint32 pos)
+{
+    Scoping::const_iterator i = std::lower_bound(s.begin(), s.end(), quint64(pos) << 32);
+    if( i != s.end() && quint32(*i >> 32) == pos )
+        return quint32(*i);
+    else
+        return NoPos;
+}
+
 void Reader::report(const Token& t)
 {
     report(t, t.val);
@@ -285,6 +761,11 @@ Reader::Object::Object(Reader::String*s):bits(0)
     set(s);
 }
 
+Reader::Object::Object(Reader::Cons* c):bits(0)
+{
+    set(c);
+}
+
 Reader::Object::Object(const Reader::Object& rhs):bits(0)
 {
     *this = rhs;
@@ -332,14 +813,23 @@ qint64 Reader::Object::getInt() const
 }
 
 void Reader::Object::set(const char* s)
+{
+    // s must be interned by Token::getSymbol
+    setAtom( s ? Token::getSymbolId(s) : 0 );
+}
+
+void Reader::Object::setAtom(quint32 id)
 {
     nil();
     bits = 0;
-    union { const char* ss; quint64 u; };
-    u = 0;
-    ss = s; // otherwise the upper 32 bits are not initialized
-    Q_ASSERT( u <= pointer_mask );
-    bits |= signbit_mask | quiet_nan_mask | Atom_mask | u;
+    bits |= signbit_mask | quiet_nan_mask | Atom_mask | id;
+}
+
+quint32 Reader::Object::getAtomId() const
+{
+    if( type() != Atom_)
+        return 0;
+    return quint32(bits & atom_mask);
 }
 
 void Reader::Object::set(Reader::String* s)
@@ -365,23 +855,16 @@ Reader::String* Reader::Object::getStr() const
 const char*Reader::Object::getAtom() const
 {
     if( type() != Atom_)
-        return "";
-    const char* res = (const char*)(bits & pointer_mask);
-    return res;
+        return Token::getSymbolById(0); // the empty atom
+    return Token::getSymbolById(bits & atom_mask);
 }
 
 int Reader::Object::getAtomLen(bool inCode) const
 {
-    const char* atom = getAtom();
-    int res = 0;
-    while( *atom )
-    {
-        res++;
-        if( inCode && Lexer::atom_delimiter(*atom) )
-            res++; // escaped in source code
-        atom++;
-    }
-    return res;
+    if( type() != Atom_)
+        return 0;
+    const Symbol* s = Symbol::get(getAtom());
+    return inCode ? s->srcLen : s->len;
 }
 
 void Reader::Object::set(Reader::List* l)
@@ -404,6 +887,25 @@ Reader::List*Reader::Object::getList() const
     return (List*)(bits & pointer_mask);
 }
 
+void Reader::Object::set(Reader::Cons* c)
+{
+    nil();
+    if( c == 0 )
+        return;
+    bits = 0;
+    union { Cons* ss; quint64 u; };
+    u = 0;
+    ss = c;
+    Q_ASSERT( u <= pointer_mask );
+    bits |= signbit_mask | quiet_nan_mask | Cons_mask | u;
+}
+
+Reader::Cons*Reader::Object::getCons() const
+{
+    Q_ASSERT( type() == Cons_);
+    return (Cons*)(bits & pointer_mask);
+}
+
 void Reader::Object::set(double d)
 {
     nil();
@@ -431,6 +933,8 @@ Reader::Object::Type Reader::Object::type() const
             return List_;
         if( tmp == Atom_mask )
             return Atom_;
+        if( tmp == Cons_mask )
+            return Cons_;
         // else
         Q_ASSERT( false);
     }else
@@ -474,6 +978,9 @@ void Reader::Object::dump(QTextStream& out) const
     case Atom_:
         out << "Atom: " << getAtom();
         break;
+    case Cons_:
+        out << "Cons";
+        break;
     default:
         out << "ERROR unknown object";
         break;
@@ -505,7 +1012,7 @@ void Reader::Object::print(QTextStream& out, int level) const
             if( l->list.size() > 1 )
             {
                 if( !l->elementPositions.isEmpty() )
-                    out << " (*" << l->elementPositions[0].row << ":" << l->elementPositions[0].col << ")";
+                    out << " (*@" << l->elementPositions[0] << ")";
                 out << endl;
             }
             for(int i = 1; i < l->list.size(); i++ )
@@ -515,7 +1022,7 @@ void Reader::Object::print(QTextStream& out, int level) const
                 if( i < l->list.size() - 1 )
                 {
                     if( i < l->elementPositions.size() )
-                        out << " (*" << l->elementPositions[i].row << ":" << l->elementPositions[i].col << ")";
+                        out << " (*@" << l->elementPositions[i] << ")";
                     out << endl;
                 }
             }
@@ -526,6 +1033,9 @@ void Reader::Object::print(QTextStream& out, int level) const
     case Atom_:
         out << getAtom();
         break;
+    case Cons_:
+        out << toString(true);
+        break;
     default:
         out << "ERROR unknown object";
         break;
@@ -564,23 +1074,27 @@ QByteArray Reader::Object::toString(bool fullList) const
         }
     case Atom_:
         return getAtom();
+    case Cons_: {
+            // the cdrs are followed in a loop; a non-list tail is printed as a dotted pair
+            const Cons* c = getCons();
+            if( !fullList )
+                return "( " + c->car.toString() + ( c->cdr.type() == Nil_ ? " )" : " ... )" );
+            QByteArray res = "( " + c->car.toString(true);
+            while( c->cdr.type() == Cons_ )
+            {
+                c = c->cdr.getCons();
+                res += " " + c->car.toString(true);
+            }
+            if( c->cdr.type() != Nil_ )
+                res += " . " + c->cdr.toString(true);
+            res += " )";
+            return res;
+        }
     default:
         return "???";
     }
 }
 
-void Reader::List::addRef()
-{
-    refcount++;
-}
-
-void Reader::List::release()
-{
-    refcount--;
-    if( refcount == 0 )
-        delete this;
-}
-
 Reader::Object Reader::List::getOuterFirst() const
 {
     if( outer && !outer->list.isEmpty() )
@@ -589,16 +1103,28 @@ Reader::Object Reader::List::getOuterFirst() const
         return Object();
 }
 
-RowCol Reader::List::getStart() const
+quint32 Reader::List::getStart() const
 {
     if( outer == 0 || outer->elementPositions.isEmpty() )
-        return RowCol();
+        return NoPos;
     for( int i = 0; i < outer->list.size(); i++ )
     {
         if( outer->list[i].type() == Object::List_ && outer->list[i].getList() == this )
             return outer->elementPositions[i];
     }
-    return RowCol();
+    return NoPos;
+}
+
+void Reader::List::addRef()
+{
+    refcount++;
+}
+
+void Reader::List::release()
+{
+    refcount--;
+    if( refcount == 0 )
+        delete this;
 }
 
 void Reader::String::addRef()
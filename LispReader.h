@@ -23,6 +23,8 @@
 #include <QString>
 #include <QList>
 #include <QTextStream>
+#include <QVector>
+#include <QHash>
 #include "LispRowCol.h"
 
 class QIODevice;
@@ -30,13 +32,15 @@ class QIODevice;
 namespace Lisp
 {
 
-class Lexer;
+class TokenSource;
 class Token;
+class Heap;
 
 class Reader
 {
 public:
     class List;
+    class Cons;
     class String;
     class Object
     {
@@ -53,6 +57,7 @@ public:
             String_,
             List_,
             Atom_,
+            Cons_,
         };
 
         Object();
@@ -61,6 +66,7 @@ public:
         Object(const char*);
         Object(List*);
         Object(String*);
+        Object(Cons*);
         Object(const Object&);
         ~Object();
 
@@ -71,17 +77,24 @@ public:
         void set(qint64);
         qint64 getInt() const;
         void set(const char*); // Atom
+        void setAtom(quint32 id);
+        quint32 getAtomId() const; // 0 if not an atom
         void set(String*);
         String* getStr() const;
         const char* getAtom() const;
         int getAtomLen(bool inCode = false) const;
         void set(List*);
         List* getList() const;
+        void set(Cons*);
+        Cons* getCons() const;
         Type type() const;
         void nil();
         void dump(QTextStream& out) const;
         void print(QTextStream& out, int level = 0) const;
         QByteArray toString(bool fullList = false) const;
+        // atoms and numbers, and with hash-consing also equal lists and strings, have the same identity
+        quint64 identity() const { return bits; }
+        bool isSame(const Object& rhs) const { return bits == rhs.bits; }
     };
 
     struct List
@@ -89,15 +102,29 @@ public:
         quint32 refcount;
     public:
         QList<Object> list;
-        RowCol end;
+        quint32 end; // offset of the closing parenthesis
         List* outer;
-        QList<RowCol> elementPositions;
+        QList<quint32> elementPositions; // offsets, see LispRowCol.h
+        quint32 span; // with hash-consing: number of position stream entries of one occurrence
 
-        List():refcount(0),outer(0){}
+        List():refcount(0),end(NoPos),outer(0),span(0){}
         void addRef();
         void release();
         Object getOuterFirst() const;
-        RowCol getStart() const;
+        quint32 getStart() const;
+    };
+
+    struct Cons
+    {
+        // a cell of the lists built at runtime; allocated by a Heap, which frees the cells it no
+        // longer reaches, so cells are not counted and may form cycles
+        quint32 flags;
+        friend class Lisp::Heap;
+    public:
+        enum { Marked = 1, Tenured = 2 };
+        Object car, cdr;
+
+        Cons(const Object& car = Object(), const Object& cdr = Object()):flags(0),car(car),cdr(cdr){}
     };
 
     struct String
@@ -114,47 +141,119 @@ public:
     typedef QHash<const char*,Object> Properties;
     struct Atom
     {
-        //const char* pname;
+        // pname, length, hash and flags are in the Lisp::Symbol record of the same id
         Object value;
         // TODO: values have local scope, not so props; therefore in a PROG scope
         // there must be a separate value entity in case of name override
         Properties props;
+        QHash<const char*,quint32> propPos; // property name -> offset of the atom in the form setting it
         QList<Object> vector;
     };
     typedef QHash<const char*,Atom> Atoms;
+    typedef QVector<quint64> Calls; // caller atom id << 32 | callee atom id, in reading order
+    // offset of a use or assignment of a variable bound by an enclosing LAMBDA, NLAMBDA, PROG, LET etc.
+    // << 32 | offset of its Param or Local declaration; ascending, so it can be searched binarily
+    typedef QVector<quint64> Scoping;
+    static quint32 declarationOf(const Scoping&, quint32 pos); // NoPos if the atom at pos is free
 
     struct Ref
     {
-        RowCol pos;
-        enum Role { Use, Call, Func, Param, Local, Lhs };
+        quint32 pos;
+        enum Role { Use, Call, Func, Param, Local, Lhs, Bound }; // Bound: a Use of a Param or Local
         quint8 role;
         quint16 len;
-        Ref(const RowCol& rc = RowCol(), quint16 l = 0, Role r = Use):pos(rc),role(r),len(l){}
+        Ref(quint32 pos = NoPos, quint16 l = 0, Role r = Use):pos(pos),role(r),len(l){}
     };
     typedef QList<Ref> Refs;
     typedef QHash<const char*,Refs> Xref;
 
+    enum Hint { None, Quoted, Data, Local, Param, Bindings, Binding, Definition, Clause, SelectClause };
+    struct SpecialForm
+    {
+        // how the arguments of a list with the given head atom are read and referenced
+        // Sequential: each binding is visible in the inits of the following ones; DefinesMacro: the
+        // first argument is defined if one of the property names is MACRO, DMACRO or BYTEMACRO
+        enum Flag { AssignsFirst = 1, PropValue = 2, PropPairs = 4, DefinesFirst = 8,
+                    Sequential = 16, DefinesMacro = 32 };
+        quint8 args[3]; // Hint of argument 1 to 3
+        quint8 rest; // Hint of all further arguments
+        quint8 flags;
+        SpecialForm(Hint a1 = None, Hint a2 = None, Hint a3 = None, Hint r = None, quint8 f = 0);
+        Hint hint(int arg) const { return Hint( arg <= 3 ? args[arg-1] : rest ); }
+    };
+    static void addSpecialForm(const char* head, const SpecialForm&);
+    static const SpecialForm* getSpecialForm(quint32 atomId);
+
+    // Optional hash-consing: equal lists and strings read with the same table are stored once and
+    // have neither outer, end nor elementPositions. Instead the Reader produces a position stream
+    // in reading order; for each element its start, then the entries of the element if it is a list,
+    // then the end of the list. A top-level list uses span entries from the sum of the spans of its
+    // preceding top-level lists. Files are then read without parallel chunks, since the reference
+    // counts of shared nodes are not atomic.
+    class ConsTable
+    {
+    public:
+        ConsTable():hits(0){}
+        Object intern(const Object&); // returns the equal object already known or registers this one
+        int size() const { return lists.size() + strings.size(); }
+        int getHits() const { return hits; }
+        qint64 byteSize() const;
+        void clear();
+    private:
+        QMultiHash<uint,Object> lists; // element identity hash -> list
+        QHash<QByteArray,Object> strings;
+        int hits;
+    };
+
+    // Auto splits large files at top-level forms and parses the chunks in parallel if possible,
+    // otherwise pipelines lexer and reader; Parallel and Pipelined fall back to Serial
+    enum Mode { Auto, Serial, Pipelined, Parallel };
+
     Reader();
 
+    void setMode(Mode m) { mode = m; }
+    void setConsTable(ConsTable* t) { cons = t; } // enables hash-consing if not null
     bool read(QIODevice*, const QString& path);
     const QString getError() const { return error; }
-    const RowCol& getPos() const { return pos; }
+    quint32 getPos() const { return pos; }
+    const LineTable& getLines() const { return lines; }
+    const QVector<quint32>& getPositions() const { return positions; } // only with hash-consing
     const Object& getAst() const { return ast; }
     const Xref& getXref() const { return xref; }
     const Atoms& getAtoms() const { return atoms; }
+    const Calls& getCalls() const { return calls; } // from the DEFINEQ functions read
+    const Xref& getDefinitions() const { return defs; } // DEFINEQ functions and DefinesFirst forms
+    const Scoping& getScoping() const { return scoping; }
 
 private:
-    enum Hint { None, Quoted, Local, Param };
-    Object next(Lexer&, List* outer, Hint hint = None);
-    Object list(Lexer& in, bool brack, List* outer, Hint outerHint);
+    static void initSpecialForms();
+    class ChunkTask;
+    friend class ChunkTask;
+    bool readParallel(const QByteArray& code, const QString& path);
+    bool readForms(TokenSource&, List* root);
+    Token nextToken(TokenSource&);
+    Object next(TokenSource&, const Token&, List* outer, Hint hint = None);
+    Object list(TokenSource& in, bool brack, List* outer, Hint outerHint);
     void report(const Token&);
     void report(const Token&, const QString&);
 
     Object ast;
     QString error;
-    RowCol pos;
+    quint32 pos;
+    LineTable lines;
+    quint32 pendingBrack; // position of a ']' which still closes the outer lists, or NoPos
+    Mode mode;
+    ConsTable* cons;
+    QVector<quint32> positions;
     Xref xref;
+    Xref defs;
     Atoms atoms;
+    Calls calls;
+    quint32 caller; // atom id of the DEFINEQ function being read, or 0
+    Scoping scoping;
+    QVector<quint64> scope; // atom id << 32 | declaration offset of the enclosing bindings, innermost last
+    QVector<quint64> pending; // declarations of the bindings list being read, not yet visible to its inits
+    bool sequential; // the bindings list about to be read belongs to a Sequential form
 };
 
 }
@@ -18,39 +18,43 @@
 */
 
 #include "LispRowCol.h"
-#include <QtDebug>
+#include <algorithm>
 using namespace Lisp;
 
-RowCol::RowCol(quint32 row, quint32 col)
+LineTable::LineTable()
 {
-    if( !setRowCol(row,col) )
-        qWarning() << "invalid row or column number";
+    starts.append(0);
 }
 
-bool RowCol::setRowCol(quint32 row, quint32 col)
+void LineTable::clear()
 {
-    static const quint32 maxRow = ( 1 << ROW_BIT_LEN ) - 1;
-    static const quint32 maxCol = ( 1 << COL_BIT_LEN ) - 1;
-    int err = 0;
-    if( row > maxRow )
-    {
-        this->row = maxRow;
-        err++;
-    }else if( row == 0 )
-    {
-        this->row = 1;
-        err++;
-    }else
-        this->row = row;
-    if( col > maxCol )
-    {
-        this->col = maxCol;
-        err++;
-    }else if( col == 0 )
-    {
-        this->col = 1;
-        err++;
-    }else
-        this->col = col;
-    return err == 0;
+    starts.resize(1);
+}
+
+void LineTable::addLine(quint32 start)
+{
+    if( start > starts.last() )
+        starts.append(start);
+}
+
+void LineTable::append(const LineTable& rhs)
+{
+    for( int i = 1; i < rhs.starts.size(); i++ )
+        addLine(rhs.starts[i]);
+}
+
+RowCol LineTable::rowCol(quint32 pos) const
+{
+    if( pos == NoPos )
+        return RowCol();
+    // the last line start which is not behind pos
+    const int row = std::upper_bound(starts.begin(), starts.end(), pos) - starts.begin();
+    return RowCol(row, pos - starts[row-1] + 1);
+}
+
+quint32 LineTable::lineStart(quint32 row) const
+{
+    if( row == 0 || int(row) > starts.size() )
+        return NoPos;
+    return starts[row-1];
 }
@@ -20,28 +20,40 @@
 * http://www.gnu.org/copyleft/gpl.html.
 */
 
-#include <QByteArray>
+#include <QVector>
 
 namespace Lisp
 {
 
+// Source positions are 32 bit offsets counting the chars delivered by Lexer::readc, which are
+// the same as in the text shown by the Navigator (see decode); row and column are derived
+// from a LineTable when needed.
+const quint32 NoPos = 0xffffffff;
+
 struct RowCol
 {
-    enum { ROW_BIT_LEN = 19, COL_BIT_LEN = 32 - ROW_BIT_LEN - 1 };
-    uint row : ROW_BIT_LEN; // supports 524k lines
-    uint col : COL_BIT_LEN; // supports 4k chars per line
-    uint unused : 1; // the sign is used to recognize the packed representation
-
-    RowCol():row(0),col(0),unused(0) {}
-    RowCol( quint32 row, quint32 col );
-    bool setRowCol( quint32 row, quint32 col );
+    quint32 row; // starts with 1
+    quint32 col; // starts with 1
+
+    RowCol():row(0),col(0) {}
+    RowCol( quint32 row, quint32 col ):row(row),col(col) {}
     bool isValid() const { return row > 0 && col > 0; } // valid lines and cols start with 1; 0 is invalid
     bool operator==( const RowCol& rhs ) const { return row == rhs.row && col == rhs.col; }
+};
 
-    quint32 packed() const { return ( row << COL_BIT_LEN ) | col; }
-    static bool isPacked( quint32 rowCol ) { return rowCol; }
-    static quint32 unpackCol(quint32 rowCol ) { return rowCol & ( ( 1 << COL_BIT_LEN ) -1 ); }
-    static quint32 unpackRow(quint32 rowCol ) { return ( ( rowCol ) >> COL_BIT_LEN ); }
+class LineTable
+{
+public:
+    LineTable();
+    void clear();
+    void addLine( quint32 start ); // start offset of the next line, ascending
+    void append( const LineTable& ); // the lines of a following chunk of the same file
+    int lineCount() const { return starts.size(); }
+    RowCol rowCol( quint32 pos ) const;
+    quint32 lineStart( quint32 row ) const; // NoPos if row is out of range
+    int byteSize() const { return starts.capacity() * sizeof(quint32); }
+private:
+    QVector<quint32> starts;
 };
 
 }
@@ -0,0 +1,128 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "LispTokenRing.h"
+#include "LispTrace.h"
+#include <QThread>
+using namespace Lisp;
+
+class TokenRing::Producer : public QThread
+{
+public:
+    TokenRing* ring;
+    Lexer lex;
+
+    Producer(TokenRing* r):ring(r){}
+    void run()
+    {
+        Trace::Span span("lex", lex.getSource());
+        while( true )
+        {
+            const Token t = lex.nextToken();
+            if( !ring->push(t) || !t.isValid() )
+                break;
+        }
+    }
+};
+
+TokenRing::TokenRing(int capacity):producer(0),head(0),tail(0),abort(0),done(false)
+{
+    int cap = 16;
+    while( cap < capacity )
+        cap <<= 1;
+    buffer.resize(cap);
+    mask = 2 * cap - 1;
+}
+
+TokenRing::~TokenRing()
+{
+    stop();
+    delete producer;
+}
+
+void TokenRing::start(const char* data, int len, const QString& sourcePath)
+{
+    stop();
+    delete producer;
+    head.store(0);
+    tail.store(0);
+    abort.store(0);
+    last = Token();
+    done = false;
+    producer = new Producer(this);
+    producer->lex.setStream(data, len, sourcePath);
+    producer->start();
+}
+
+void TokenRing::stop()
+{
+    if( producer == 0 )
+        return;
+    abort.store(1);
+    producer->wait();
+}
+
+bool TokenRing::push(const Token& t)
+{
+    // producer side
+    const int cap = buffer.size();
+    const int h = head.load();
+    while( ( ( h - tail.loadAcquire() ) & mask ) == cap )
+    {
+        if( abort.load() )
+            return false;
+        QThread::yieldCurrentThread();
+    }
+    Slot& s = buffer[h & ( cap - 1 )];
+    s.pos = t.pos;
+    s.type = t.type;
+    s.len = t.len;
+    s.val = t.val;
+    head.storeRelease( ( h + 1 ) & mask );
+    return true;
+}
+
+Token TokenRing::nextToken()
+{
+    // consumer side
+    if( done || producer == 0 )
+        return last;
+    const int t = tail.load();
+    while( head.loadAcquire() == t )
+        QThread::yieldCurrentThread();
+    Slot& s = buffer[t & ( buffer.size() - 1 )];
+    Token res(s.type, s.pos, s.len, s.val);
+    s.val = QByteArray(); // strings and numbers are freed here, not when the slot is reused
+    tail.storeRelease( ( t + 1 ) & mask );
+    if( !res.isValid() )
+    {
+        last = res;
+        done = true;
+    }
+    return res;
+}
+
+const LineTable& TokenRing::getLines() const
+{
+    static LineTable empty;
+    if( producer == 0 )
+        return empty;
+    producer->wait(); // the lexer is done after the last token anyway
+    return producer->lex.getLines();
+}
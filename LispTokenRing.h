@@ -0,0 +1,65 @@
+#ifndef LISPTOKENRING_H
+#define LISPTOKENRING_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QAtomicInt>
+#include <QVector>
+#include "LispLexer.h"
+
+namespace Lisp
+{
+
+// A Lexer running on its own thread, feeding a bounded single-producer/single-consumer ring;
+// the consumer calls nextToken() on the thread which started the ring.
+class TokenRing : public TokenSource
+{
+public:
+    enum { DefaultCapacity = 4096 }; // power of two
+    TokenRing(int capacity = DefaultCapacity);
+    ~TokenRing();
+
+    // data is borrowed and must stay alive until stop()
+    void start(const char* data, int len, const QString& sourcePath);
+    void stop(); // aborts the producer if still running and waits for it
+    Token nextToken();
+    const LineTable& getLines() const; // complete after the last token or stop()
+
+private:
+    struct Slot
+    {
+        quint32 pos;
+        quint16 type;
+        quint16 len;
+        QByteArray val; // the interned pname for atoms, no allocation
+    };
+    bool push(const Token&);
+    class Producer;
+    Producer* producer;
+    QVector<Slot> buffer;
+    int mask; // of the indices, which run modulo twice the capacity
+    QAtomicInt head, tail, abort;
+    Token last; // returned again after Eof or error
+    bool done;
+};
+
+}
+
+#endif // LISPTOKENRING_H
@@ -0,0 +1,134 @@
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include "LispTrace.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+using namespace Lisp;
+
+bool Trace::s_enabled = false;
+
+struct Event
+{
+    const char* name;
+    QString arg;
+    qint64 start, end;
+    QThread* thread;
+};
+static QVector<Event> s_events;
+static QMutex s_mutex;
+static QElapsedTimer s_clock;
+
+void Trace::setEnabled(bool on)
+{
+    if( on && !s_clock.isValid() )
+        s_clock.start();
+    s_enabled = on;
+}
+
+int Trace::count()
+{
+    QMutexLocker lock(&s_mutex);
+    return s_events.size();
+}
+
+void Trace::clear()
+{
+    QMutexLocker lock(&s_mutex);
+    s_events.clear();
+}
+
+qint64 Trace::now()
+{
+    return s_clock.nsecsElapsed();
+}
+
+QString Trace::fileName(const QString& path)
+{
+    return QFileInfo(path).fileName();
+}
+
+void Trace::add(const char* name, const QString& arg, qint64 start, qint64 end)
+{
+    Event e;
+    e.name = name;
+    e.arg = arg;
+    e.start = start;
+    e.end = end;
+    e.thread = QThread::currentThread();
+    QMutexLocker lock(&s_mutex);
+    s_events.append(e);
+}
+
+static QString escape(const QString& str)
+{
+    QString res;
+    res.reserve(str.size());
+    for( int i = 0; i < str.size(); i++ )
+    {
+        const QChar ch = str[i];
+        if( ch == '"' || ch == '\\' )
+            res += '\\';
+        if( ch.unicode() < 0x20 )
+            res += QString("\\u%1").arg(ch.unicode(), 4, 16, QChar('0'));
+        else
+            res += ch;
+    }
+    return res;
+}
+
+bool Trace::save(const QString& path)
+{
+    QFile f(path);
+    if( !f.open(QIODevice::WriteOnly) )
+        return false;
+    QMutexLocker lock(&s_mutex);
+    QHash<QThread*,int> tids; // small numbers in order of appearance
+    QTextStream out(&f);
+    out.setCodec("UTF-8");
+    out << "{\"traceEvents\":[" << endl;
+    for( int i = 0; i < s_events.size(); i++ )
+    {
+        const Event& e = s_events[i];
+        int tid = tids.value(e.thread);
+        if( tid == 0 )
+        {
+            tid = tids.size() + 1;
+            tids.insert(e.thread, tid);
+        }
+        out << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+            << ",\"ts\":" << QString::number(e.start / 1000.0, 'f', 3)
+            << ",\"dur\":" << QString::number((e.end - e.start) / 1000.0, 'f', 3);
+        if( !e.arg.isEmpty() )
+            out << ",\"args\":{\"file\":\"" << escape(e.arg) << "\"}";
+        out << "}";
+        if( i < s_events.size() - 1 )
+            out << ",";
+        out << endl;
+    }
+    out << "],\"displayTimeUnit\":\"ms\"}" << endl;
+    return true;
+}
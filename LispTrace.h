@@ -0,0 +1,71 @@
+#ifndef LISPTRACE_H
+#define LISPTRACE_H
+
+/*
+* Copyright 2024 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Interlisp project.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include <QString>
+
+namespace Lisp
+{
+
+// Records scoped spans as Chrome trace events (chrome://tracing, Perfetto); a disabled Span
+// costs a test of a static flag, as long as its arg is an existing string; a FileName arg is
+// only derived from the path if enabled.
+class Trace
+{
+public:
+    class Span
+    {
+    public:
+        Span(const char* name):name(name),start(s_enabled ? now() : -1) {}
+        enum Arg { Text, FileName }; // FileName: arg is a path of which only the file name is recorded
+        Span(const char* name, const QString& arg, Arg kind = Text):name(name),start(s_enabled ? now() : -1)
+        {
+            if( start >= 0 )
+                this->arg = kind == FileName ? fileName(arg) : arg;
+        }
+        ~Span()
+        {
+            if( start >= 0 )
+                add(name, arg, start, now());
+        }
+    private:
+        const char* name; // static string
+        QString arg;
+        qint64 start; // ns, -1 if disabled
+    };
+
+    static void setEnabled(bool on);
+    static bool isEnabled() { return s_enabled; }
+    static int count();
+    static void clear();
+    static bool save(const QString& path); // trace event JSON
+private:
+    friend class Span;
+    static qint64 now();
+    static QString fileName(const QString& path);
+    static void add(const char* name, const QString& arg, qint64 start, qint64 end);
+    static bool s_enabled;
+};
+
+}
+
+#endif // LISPTRACE_H